@@ -0,0 +1,391 @@
+/*****************************************************************************
+ * bench.c : micro-benchmark of the listen pipeline of the listenbrainz plugin
+ *****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * The plugin is built as is against the stubs of include/, then every listen
+ * goes the way it goes in VLC: meta data read from the played item, checked
+ * and queued (serialized to JSON), then joined with the others of its batch
+ * into a submission and wrapped into its HTTP request, which is where the
+ * network would take over. Batches up to 10k listens need a queue as large,
+ * hence the QUEUE_MAX of the Makefile.
+ *
+ * The file sink is then measured end to end, down to the fsync() of each
+ * batch, into a temporary file: BENCH_SINK_DIR, else /tmp.
+ */
+
+#include "../vlc-3.0/listenbrainz.c"
+
+bench_allocs_t bench_allocs;
+bench_locks_t bench_locks;
+bench_vars_t bench_vars;
+
+/* at least as many listens per batch size, for stable timings */
+#define BENCH_LISTENS 100000
+
+static const int pi_batches[] = { 1, 10, 100, 1000, 10000 };
+
+/* at least as many listens per batch size through the file sink, which
+ * syncs every batch to the disk */
+#define BENCH_SINK_LISTENS 2000
+
+/* meta data of the played items, plain and needing escapes */
+static input_item_t p_items[] = {
+    { .psz_uri = "file:///music/Radiohead/OK%20Computer/01.flac",
+      .psz_artist = "Radiohead", .psz_title = "Airbag",
+      .psz_album = "OK Computer", .psz_tracknum = "1",
+      .psz_trackid = "8b4e5bcb-1a24-4a75-a4b3-8b4de1e8e4d5",
+      .i_duration = INT64_C(284000000) },
+    { .psz_uri = "file:///music/Bj%C3%B6rk/Homogenic/05.ogg",
+      .psz_artist = "Björk", .psz_title = "Jóga",
+      .psz_album = "Homogenic", .psz_tracknum = "5",
+      .i_duration = INT64_C(305000000) },
+    { .psz_uri = "file:///music/Various/Don't%20Stop.mp3",
+      .psz_artist = "Fleetwood Mac", .psz_title = "Don't Stop (2004 Remaster)",
+      .i_duration = INT64_C(193000000) },
+};
+
+/* meta data of a bulk import, to escape as JSON strings */
+static const struct
+{
+    const char *psz_name;
+    const char *psz_meta;
+} p_corpus[] = {
+    { "ascii", "Symphony No. 9 in D minor, Op. 125 - IV. Presto - Allegro assai "
+               "(Live at the Royal Albert Hall, 1985 Digital Remaster)" },
+    { "latin", "Ludwig van Beethoven: Sinfonie Nr. 9 d-Moll op. 125 â "
+               "Finale. Presto â Â»O Freunde, nicht diese TÃ¶ne!Â«" },
+    { "cjk",   "äº¤é¿æ²ç¬¬ä¹çª "
+               "ãç­èª¿ ä½å125 "
+               "ãåå±ã ç¬¬4æ¥½ç« " },
+    { "escapes", "\"Ode \"To\" Joy\"\t(feat. \\ Choir)\r\nBonus: broken \xff\xfe bytes" },
+};
+
+typedef struct bench_result_t
+{
+    uint64_t    i_listens;
+    uint64_t    i_ns;
+    uint64_t    i_allocs;
+    uint64_t    i_bytes;
+    uint64_t    i_request;      /**< bytes of the HTTP requests */
+} bench_result_t;
+
+/* Play i_batch songs */
+static void PlayBatch(intf_thread_t *p_intf, int i_batch, time_t *p_date)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+
+    for (int i = 0; i < i_batch; i++)
+    {
+        input_thread_t input = {
+            .p_item = &p_items[(*p_date)++ % ARRAY_SIZE(p_items)],
+        };
+
+        ReadMetaData(p_intf, &input, true);
+        vlc_mutex_lock(&p_sys->lock);
+        p_sys->p_current_song.date = *p_date;
+        p_sys->i_played = 240 * CLOCK_FREQ;
+        vlc_mutex_unlock(&p_sys->lock);
+        AddToQueue(p_intf);
+    }
+}
+
+/* Play i_batch songs, then submit them at once */
+static int RunBatch(intf_thread_t *p_intf, int i_batch, time_t *p_date,
+                    uint64_t *pi_request)
+{
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_endpoint_t *p_ep = &p_sys->p_endpoints[0];
+    struct vlc_memstream    payload, req;
+
+    PlayBatch(p_intf, i_batch, p_date);
+
+    vlc_mutex_lock(&p_sys->lock);
+    if (p_sys->i_queue_base + p_sys->i_songs - p_ep->i_next != (uint64_t) i_batch)
+    {
+        vlc_mutex_unlock(&p_sys->lock);
+        return VLC_EGENERIC;
+    }
+    int i_ret = ForgePayload(p_sys, p_ep->i_next, i_batch, &payload);
+    vlc_mutex_unlock(&p_sys->lock);
+    if (i_ret)
+        return VLC_ENOMEM;
+
+    i_ret = ForgeRequest(p_ep, &payload, false, &req);
+    free(payload.ptr);
+    if (i_ret)
+        return VLC_ENOMEM;
+    *pi_request += req.length;
+    free(req.ptr);
+
+    vlc_mutex_lock(&p_sys->lock);
+    p_ep->i_next += i_batch;
+    TrimQueue(p_sys);
+    vlc_mutex_unlock(&p_sys->lock);
+    return VLC_SUCCESS;
+}
+
+static int Measure(intf_thread_t *p_intf, int i_batch, time_t *p_date,
+                   bench_result_t *p_res)
+{
+    int i_rounds = __MAX(BENCH_LISTENS / i_batch, 1);
+
+    memset(p_res, 0, sizeof(*p_res));
+    bench_allocs_t start = bench_allocs;
+    uint64_t i_start = bench_ns();
+
+    for (int i = 0; i < i_rounds; i++)
+        if (RunBatch(p_intf, i_batch, p_date, &p_res->i_request))
+            return VLC_EGENERIC;
+
+    p_res->i_ns = bench_ns() - i_start;
+    p_res->i_listens = (uint64_t) i_rounds * i_batch;
+    p_res->i_allocs = bench_allocs.i_count - start.i_count;
+    p_res->i_bytes = bench_allocs.i_bytes - start.i_bytes;
+    return VLC_SUCCESS;
+}
+
+/* Play then deliver listens through the sink of p_ep, as Run does, and
+ * report them in listens/s */
+static int MeasureSink(intf_thread_t *p_intf, listenbrainz_endpoint_t *p_ep,
+                       int i_batch, time_t *p_date, double *pf_rate,
+                       double *pf_bytes)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    int         i_rounds = __MAX(BENCH_SINK_LISTENS / i_batch, 1);
+    uint64_t    i_ns = 0, i_bytes = 0;
+
+    for (int i = 0; i < i_rounds; i++)
+    {
+        struct vlc_memstream payload;
+        char p_body[1024];
+
+        PlayBatch(p_intf, i_batch, p_date);
+
+        /* the time to play is not the one of the sink */
+        uint64_t i_start = bench_ns();
+        vlc_mutex_lock(&p_sys->lock);
+        int i_ret = p_ep->p_sink->pf_forge(p_sys, p_ep->i_next, i_batch,
+                                           &payload);
+        vlc_mutex_unlock(&p_sys->lock);
+        if (i_ret)
+            return VLC_ENOMEM;
+        i_ret = p_ep->p_sink->pf_send(p_ep, &payload, false, p_body,
+                                      sizeof(p_body));
+        i_bytes += payload.length;
+        free(payload.ptr);
+        if (i_ret != 200)
+            return VLC_EGENERIC;
+        i_ns += bench_ns() - i_start;
+
+        vlc_mutex_lock(&p_sys->lock);
+        p_ep->i_next += i_batch;
+        p_sys->pi_metrics[p_ep->p_sink->i_listens] += i_batch;
+        p_sys->pi_metrics[p_ep->p_sink->i_bytes] += payload.length;
+        TrimQueue(p_sys);
+        vlc_mutex_unlock(&p_sys->lock);
+    }
+    p_ep->p_sink->pf_close(p_ep);
+
+    *pf_rate = (double) i_rounds * i_batch * 1e9 / i_ns;
+    *pf_bytes = (double) i_bytes / ((double) i_rounds * i_batch);
+    return VLC_SUCCESS;
+}
+
+static int MeasureSinks(intf_thread_t *p_intf, listenbrainz_endpoint_t *p_ep,
+                        time_t *p_date)
+{
+    const char *psz_dir = getenv("BENCH_SINK_DIR");
+    char psz_path[256];
+
+    snprintf(psz_path, sizeof(psz_path), "%s/listenbrainz-bench-XXXXXX",
+             psz_dir ? psz_dir : "/tmp");
+    int i_fd = mkstemp(psz_path);
+    if (i_fd == -1)
+    {
+        perror(psz_path);
+        return VLC_EGENERIC;
+    }
+    close(i_fd);
+
+    /* in place of the main endpoint, so that the queue is trimmed */
+    listenbrainz_endpoint_t file = *p_ep;
+    file.p_sink = &p_sinks[SINK_FILE];
+    file.psz_path = psz_path;
+    file.psz_name = psz_path;
+    file.i_fd = -1;
+    p_intf->p_sys->p_endpoints = &file;
+
+    int i_ret = VLC_SUCCESS;
+    printf("\n%8s %14s %14s\n", "batch", "file/s", "bytes/listen");
+    for (size_t i = 0; i < ARRAY_SIZE(pi_batches) && !i_ret; i++)
+    {
+        double f_rate, f_bytes;
+
+        i_ret = MeasureSink(p_intf, &file, pi_batches[i], p_date, &f_rate,
+                            &f_bytes);
+        if (!i_ret)
+            printf("%8d %14.0f %14.1f\n", pi_batches[i], f_rate, f_bytes);
+    }
+    p_intf->p_sys->p_endpoints = p_ep;
+    p_ep->i_next = file.i_next;
+    unlink(psz_path);
+    return i_ret;
+}
+
+/* Escape the corpus as JSON strings with the given kernel, in MB/s, and
+ * check that the output matches the one of the scalar kernel */
+static int MeasureEscape(size_t (*pf_span)(const char *, size_t),
+                         const char *psz_meta, char **ppsz_ref, double *pf_rate)
+{
+    struct vlc_memstream json;
+    size_t i_len = strlen(psz_meta);
+    int i_rounds = (64 << 20) / i_len;
+
+    JsonSpan = pf_span;
+    vlc_memstream_open(&json);
+    uint64_t i_start = bench_ns();
+    for (int i = 0; i < i_rounds; i++)
+        PutJsonString(&json, psz_meta);
+    *pf_rate = (double) i_len * i_rounds * 1e3 / (bench_ns() - i_start);
+    if (vlc_memstream_close(&json))
+        return VLC_ENOMEM;
+
+    if (*ppsz_ref == NULL)
+    {
+        *ppsz_ref = json.ptr;
+        return VLC_SUCCESS;
+    }
+    int i_ret = strcmp(*ppsz_ref, json.ptr) ? VLC_EGENERIC : VLC_SUCCESS;
+    free(json.ptr);
+    return i_ret;
+}
+
+static int MeasureKernels(void)
+{
+    static const struct
+    {
+        const char *psz_name;
+        size_t    (*pf_span)(const char *, size_t);
+    } p_kernels[] = {
+        { "scalar", JsonSpanC },
+#ifdef HAVE_JSON_SIMD
+        { "sse2", JsonSpanSSE2 },
+        { "avx2", JsonSpanAVX2 },
+#endif
+    };
+    size_t (*pf_selected)(const char *, size_t) = JsonSpan;
+
+    printf("\n%8s", "MB/s");
+    for (size_t i = 0; i < ARRAY_SIZE(p_corpus); i++)
+        printf(" %10s", p_corpus[i].psz_name);
+    printf("\n");
+
+    for (size_t k = 0; k < ARRAY_SIZE(p_kernels); k++)
+    {
+#ifdef HAVE_JSON_SIMD
+        if (p_kernels[k].pf_span == JsonSpanAVX2 && !vlc_CPU_AVX2())
+            continue;
+#endif
+        printf("%8s", p_kernels[k].psz_name);
+        for (size_t i = 0; i < ARRAY_SIZE(p_corpus); i++)
+        {
+            static char *ppsz_ref[ARRAY_SIZE(p_corpus)];
+            double f_rate;
+
+            if (MeasureEscape(p_kernels[k].pf_span, p_corpus[i].psz_meta,
+                              &ppsz_ref[i], &f_rate))
+            {
+                fprintf(stderr, "%s escapes %s differently\n",
+                        p_kernels[k].psz_name, p_corpus[i].psz_name);
+                return VLC_EGENERIC;
+            }
+            printf(" %10.0f", f_rate);
+        }
+        printf("\n");
+    }
+    JsonSpan = pf_selected;
+    return VLC_SUCCESS;
+}
+
+int main(void)
+{
+    intf_thread_t           intf = { .obj = { .libvlc = NULL } };
+    listenbrainz_endpoint_t ep = {
+        .url = {
+            .psz_protocol = "https",
+            .psz_host = "api.listenbrainz.org",
+            .psz_path = "/1/submit-listens",
+        },
+        .psz_token = "00000000-0000-0000-0000-000000000000",
+        .i_token = TOKEN_VALID,
+        .p_sink = &p_sinks[SINK_HTTP],
+        .psz_name = "api.listenbrainz.org",
+        .i_fd = -1,
+        .p_intf = &intf,
+    };
+    time_t                  date = 1700000000;
+    bench_result_t          res;
+
+    intf_sys_t *p_sys = calloc(1, sizeof(*p_sys));
+    if (p_sys == NULL)
+        return 1;
+    intf.p_sys = p_sys;
+    vlc_mutex_init(&p_sys->lock);
+    vlc_cond_init(&p_sys->wait);
+    vlc_cond_init(&p_sys->import_wait);
+    vlc_mutex_init(&p_sys->trace_lock);
+    p_sys->p_endpoints = &ep;
+    p_sys->i_endpoints = 1;
+    JsonSelect();
+
+    /* warm up the caches and the allocator */
+    if (Measure(&intf, 100, &date, &res))
+        goto error;
+
+    printf("%8s %10s %12s %14s %14s %14s\n", "batch", "listens",
+           "ns/listen", "allocs/listen", "bytes/listen", "request/listen");
+    for (size_t i = 0; i < ARRAY_SIZE(pi_batches); i++)
+    {
+        if (Measure(&intf, pi_batches[i], &date, &res))
+            goto error;
+        printf("%8d %10"PRIu64" %12.1f %14.2f %14.1f %14.1f\n", pi_batches[i],
+               res.i_listens, (double) res.i_ns / res.i_listens,
+               (double) res.i_allocs / res.i_listens,
+               (double) res.i_bytes / res.i_listens,
+               (double) res.i_request / res.i_listens);
+    }
+
+    if (MeasureSinks(&intf, &ep, &date))
+        goto error;
+
+    if (MeasureKernels())
+        return 1;
+
+    vlc_cond_destroy(&p_sys->wait);
+    vlc_cond_destroy(&p_sys->import_wait);
+    vlc_mutex_destroy(&p_sys->trace_lock);
+    vlc_mutex_destroy(&p_sys->lock);
+    free(p_sys->strings.pp_buckets);
+    free(p_sys);
+    return 0;
+
+error:
+    fprintf(stderr, "listens were lost in the pipeline\n");
+    return 1;
+}
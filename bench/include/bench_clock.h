@@ -0,0 +1,29 @@
+/*****************************************************************************
+ * bench_clock.h : simulated clock of the load generator
+ *****************************************************************************
+ * Replaces the clocks of the plugin through LISTENBRAINZ_CLOCK: time only
+ * moves when the generator advances it, so that hours of playback are
+ * replayed as fast as the callbacks run.
+ *****************************************************************************/
+
+#ifndef BENCH_CLOCK_H
+#define BENCH_CLOCK_H
+
+extern mtime_t bench_clock;
+
+#define ClockNow() __atomic_load_n(&bench_clock, __ATOMIC_RELAXED)
+
+static inline void ClockWait(mtime_t deadline)
+{
+    VLC_UNUSED(deadline);
+}
+
+static inline time_t ClockTime(time_t *p_time)
+{
+    time_t i_time = ClockNow() / CLOCK_FREQ;
+    if (p_time != NULL)
+        *p_time = i_time;
+    return i_time;
+}
+
+#endif
@@ -0,0 +1,503 @@
+/*****************************************************************************
+ * vlc_common.h : stubs of the VLC core for the listenbrainz benchmark
+ *****************************************************************************
+ * Only what the plugin uses, with the behaviour the benchmarks rely on.
+ * Every allocation of the plugin, and of these stubs, goes through the
+ * allocation counters, and every lock through the lock counters, which the
+ * benchmark programs define.
+ *****************************************************************************/
+
+#ifndef BENCH_VLC_COMMON_H
+#define BENCH_VLC_COMMON_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*****************************************************************************
+ * Allocation counters
+ *****************************************************************************/
+typedef struct bench_allocs_t
+{
+    uint64_t    i_count;    /**< allocations */
+    uint64_t    i_bytes;    /**< bytes requested */
+} bench_allocs_t;
+
+extern bench_allocs_t bench_allocs;
+
+/* the counters are shared by the threads of the load generator */
+#define bench_count(counter, n) \
+    __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+static inline void bench_count_alloc(size_t i_size)
+{
+    bench_count(bench_allocs.i_count, 1);
+    bench_count(bench_allocs.i_bytes, i_size);
+}
+
+static inline void *bench_malloc(size_t i_size)
+{
+    bench_count_alloc(i_size);
+    return (malloc)(i_size);
+}
+
+static inline void *bench_calloc(size_t i_count, size_t i_size)
+{
+    bench_count_alloc(i_count * i_size);
+    return (calloc)(i_count, i_size);
+}
+
+static inline void *bench_realloc(void *p, size_t i_size)
+{
+    bench_count_alloc(i_size);
+    return (realloc)(p, i_size);
+}
+
+static inline char *bench_memdup0(const char *psz, size_t i_len)
+{
+    char *psz_dup = bench_malloc(i_len + 1);
+    if (psz_dup != NULL)
+    {
+        memcpy(psz_dup, psz, i_len);
+        psz_dup[i_len] = '\0';
+    }
+    return psz_dup;
+}
+
+static inline char *bench_strndup(const char *psz, size_t i_max)
+{
+    return bench_memdup0(psz, strnlen(psz, i_max));
+}
+
+static inline char *bench_strdup(const char *psz)
+{
+    return bench_memdup0(psz, strlen(psz));
+}
+
+static inline int bench_vasprintf(char **ppsz, const char *psz_fmt, va_list ap)
+{
+    va_list aq;
+    va_copy(aq, ap);
+    int i_len = vsnprintf(NULL, 0, psz_fmt, aq);
+    va_end(aq);
+
+    *ppsz = i_len < 0 ? NULL : bench_malloc(i_len + 1);
+    if (*ppsz == NULL)
+        return -1;
+    return vsnprintf(*ppsz, i_len + 1, psz_fmt, ap);
+}
+
+static inline int bench_asprintf(char **ppsz, const char *psz_fmt, ...)
+{
+    va_list ap;
+    va_start(ap, psz_fmt);
+    int i_ret = bench_vasprintf(ppsz, psz_fmt, ap);
+    va_end(ap);
+    return i_ret;
+}
+
+#define malloc(n)           bench_malloc(n)
+#define calloc(n, s)        bench_calloc(n, s)
+#define realloc(p, n)       bench_realloc(p, n)
+#define strdup(s)           bench_strdup(s)
+#define strndup(s, n)       bench_strndup(s, n)
+#define asprintf(...)       bench_asprintf(__VA_ARGS__)
+#define vasprintf(p, f, a)  bench_vasprintf(p, f, a)
+
+/*****************************************************************************
+ * Basics
+ *****************************************************************************/
+#define PACKAGE "vlc"
+#define VERSION "3.0.0"
+
+#define VLC_UNUSED(x) (void)(x)
+#define VLC_FORMAT(x, y) __attribute__ ((format(printf, x, y)))
+#define likely(p)   __builtin_expect(!!(p), 1)
+#define unlikely(p) __builtin_expect(!!(p), 0)
+#define FREENULL(a) do { free(a); (a) = NULL; } while (0)
+#define EMPTY_STR(str) (!str || !*str)
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define __MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define _(str) (str)
+
+#define VLC_SUCCESS     0
+#define VLC_EGENERIC    (-1)
+#define VLC_ENOMEM      (-2)
+
+#define DIR_SEP "/"
+
+typedef int64_t mtime_t;
+#define CLOCK_FREQ INT64_C(1000000)
+
+static inline mtime_t mdate(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return INT64_C(1000000) * ts.tv_sec + ts.tv_nsec / 1000;
+}
+
+static inline void mwait(mtime_t deadline)
+{
+    mtime_t i_delay = deadline - mdate();
+    if (i_delay > 0)
+        usleep(i_delay);
+}
+
+/*****************************************************************************
+ * Objects and messages
+ *****************************************************************************/
+typedef struct libvlc_int_t libvlc_int_t;
+typedef struct vlc_object_t vlc_object_t;
+#define VLC_OBJECT(x) ((vlc_object_t *)(x))
+#define vlc_object_hold(o) (o)
+#define vlc_object_release(o) ((void)(o))
+
+static inline VLC_FORMAT(3, 4)
+void bench_Log(void *p_obj, int i_type, const char *psz_fmt, ...)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(i_type); VLC_UNUSED(psz_fmt);
+}
+
+#define msg_Info(o, ...)    bench_Log(o, 0, __VA_ARGS__)
+#define msg_Err(o, ...)     bench_Log(o, 1, __VA_ARGS__)
+#define msg_Warn(o, ...)    bench_Log(o, 2, __VA_ARGS__)
+#define msg_Dbg(o, ...)     bench_Log(o, 3, __VA_ARGS__)
+
+static inline const char *vlc_strerror_c(int i_errnum)
+{
+    return strerror(i_errnum);
+}
+
+/*****************************************************************************
+ * Threads
+ *****************************************************************************/
+typedef pthread_mutex_t vlc_mutex_t;
+typedef pthread_cond_t vlc_cond_t;
+typedef pthread_t vlc_thread_t;
+
+#define VLC_THREAD_PRIORITY_LOW 0
+
+static inline void vlc_mutex_init(vlc_mutex_t *p_lock)
+{
+    pthread_mutex_init(p_lock, NULL);
+}
+
+static inline void vlc_mutex_destroy(vlc_mutex_t *p_lock)
+{
+    pthread_mutex_destroy(p_lock);
+}
+
+typedef struct bench_locks_t
+{
+    uint64_t    i_count;    /**< locks taken */
+    uint64_t    i_waits;    /**< of which contended */
+    uint64_t    i_wait_ns;  /**< time waited for them */
+    uint64_t    i_max_ns;   /**< longest wait */
+} bench_locks_t;
+
+extern bench_locks_t bench_locks;
+
+static inline uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return UINT64_C(1000000000) * ts.tv_sec + ts.tv_nsec;
+}
+
+static inline void vlc_mutex_lock(vlc_mutex_t *p_lock)
+{
+    bench_count(bench_locks.i_count, 1);
+    if (pthread_mutex_trylock(p_lock) == 0)
+        return;
+
+    uint64_t i_start = bench_ns();
+    pthread_mutex_lock(p_lock);
+    uint64_t i_wait = bench_ns() - i_start;
+
+    bench_count(bench_locks.i_waits, 1);
+    bench_count(bench_locks.i_wait_ns, i_wait);
+    uint64_t i_max = __atomic_load_n(&bench_locks.i_max_ns, __ATOMIC_RELAXED);
+    while (i_wait > i_max
+        && !__atomic_compare_exchange_n(&bench_locks.i_max_ns, &i_max, i_wait,
+                                        true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+}
+
+static inline void vlc_mutex_unlock(vlc_mutex_t *p_lock)
+{
+    pthread_mutex_unlock(p_lock);
+}
+
+static inline void vlc_cond_init(vlc_cond_t *p_cond)
+{
+    pthread_cond_init(p_cond, NULL);
+}
+
+static inline void vlc_cond_destroy(vlc_cond_t *p_cond)
+{
+    pthread_cond_destroy(p_cond);
+}
+
+static inline void vlc_cond_signal(vlc_cond_t *p_cond)
+{
+    pthread_cond_signal(p_cond);
+}
+
+static inline void vlc_cond_broadcast(vlc_cond_t *p_cond)
+{
+    pthread_cond_broadcast(p_cond);
+}
+
+static inline void vlc_cond_wait(vlc_cond_t *p_cond, vlc_mutex_t *p_lock)
+{
+    pthread_cond_wait(p_cond, p_lock);
+}
+
+/* the deadline is on the clock of mdate(), the condition on the real time */
+static inline int vlc_cond_timedwait(vlc_cond_t *p_cond, vlc_mutex_t *p_lock,
+                                     mtime_t deadline)
+{
+    struct timespec ts;
+    mtime_t i_delay = __MAX(deadline - mdate(), 0);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += i_delay / CLOCK_FREQ;
+    ts.tv_nsec += (i_delay % CLOCK_FREQ) * 1000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(p_cond, p_lock, &ts);
+}
+
+static inline int vlc_clone(vlc_thread_t *p_thread, void *(*entry)(void *),
+                            void *data, int i_priority)
+{
+    VLC_UNUSED(i_priority);
+    return pthread_create(p_thread, NULL, entry, data);
+}
+
+static inline void vlc_cancel(vlc_thread_t thread)
+{
+    pthread_cancel(thread);
+}
+
+static inline void vlc_join(vlc_thread_t thread, void **pp_result)
+{
+    pthread_join(thread, pp_result);
+}
+
+static inline int vlc_savecancel(void)
+{
+    int i_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &i_state);
+    return i_state;
+}
+
+static inline void vlc_restorecancel(int i_state)
+{
+    pthread_setcancelstate(i_state, NULL);
+}
+
+static inline unsigned long vlc_thread_id(void)
+{
+    return (unsigned long) pthread_self();
+}
+
+static inline void vlc_cleanup_lock(void *p_lock)
+{
+    vlc_mutex_unlock(p_lock);
+}
+
+#define vlc_cleanup_push(routine, arg) pthread_cleanup_push(routine, arg)
+#define vlc_cleanup_pop() pthread_cleanup_pop(0)
+#define mutex_cleanup_push(lock) vlc_cleanup_push(vlc_cleanup_lock, lock)
+
+/*****************************************************************************
+ * Big-endian integers
+ *****************************************************************************/
+static inline uint16_t GetWBE(const void *p)
+{
+    const uint8_t *p_byte = p;
+    return (p_byte[0] << 8) | p_byte[1];
+}
+
+static inline uint32_t GetDWBE(const void *p)
+{
+    const uint8_t *p_byte = p;
+    return ((uint32_t) GetWBE(p_byte) << 16) | GetWBE(p_byte + 2);
+}
+
+static inline uint64_t GetQWBE(const void *p)
+{
+    const uint8_t *p_byte = p;
+    return ((uint64_t) GetDWBE(p_byte) << 32) | GetDWBE(p_byte + 4);
+}
+
+static inline void SetWBE(void *p, uint16_t i_value)
+{
+    uint8_t *p_byte = p;
+    p_byte[0] = i_value >> 8;
+    p_byte[1] = i_value;
+}
+
+static inline void SetDWBE(void *p, uint32_t i_value)
+{
+    uint8_t *p_byte = p;
+    SetWBE(p_byte, i_value >> 16);
+    SetWBE(p_byte + 2, i_value);
+}
+
+static inline void SetQWBE(void *p, uint64_t i_value)
+{
+    uint8_t *p_byte = p;
+    SetDWBE(p_byte, i_value >> 32);
+    SetDWBE(p_byte + 4, i_value);
+}
+
+typedef struct vlc_timer *vlc_timer_t;
+
+static inline int vlc_timer_create(vlc_timer_t *p_timer,
+                                   void (*func)(void *), void *data)
+{
+    VLC_UNUSED(p_timer); VLC_UNUSED(func); VLC_UNUSED(data);
+    return VLC_EGENERIC;
+}
+
+static inline void vlc_timer_destroy(vlc_timer_t timer)
+{
+    VLC_UNUSED(timer);
+}
+
+static inline void vlc_timer_schedule(vlc_timer_t timer, bool b_absolute,
+                                      mtime_t value, mtime_t interval)
+{
+    VLC_UNUSED(timer); VLC_UNUSED(b_absolute);
+    VLC_UNUSED(value); VLC_UNUSED(interval);
+}
+
+/*****************************************************************************
+ * Variables: only those of the inputs exist, if the program simulates them
+ *****************************************************************************/
+#define VLC_VAR_BOOL        0x0020
+#define VLC_VAR_INTEGER     0x0030
+#define VLC_VAR_STRING      0x0040
+#define VLC_VAR_FLOAT       0x0050
+#define VLC_VAR_ADDRESS     0x0070
+#define VLC_VAR_DOINHERIT   0x8000
+
+typedef union
+{
+    int64_t     i_int;
+    bool        b_bool;
+    float       f_float;
+    char       *psz_string;
+    void       *p_address;
+} vlc_value_t;
+
+typedef int (*vlc_callback_t)(vlc_object_t *, const char *,
+                              vlc_value_t, vlc_value_t, void *);
+
+typedef struct bench_vars_t
+{
+    int64_t   (*pf_get_integer)(void *p_obj, const char *psz_name);
+    float     (*pf_get_float)(void *p_obj, const char *psz_name);
+    int       (*pf_count_choices)(void *p_obj, const char *psz_name);
+    char     *(*pf_inherit_string)(void *p_obj, const char *psz_name);
+} bench_vars_t;
+
+extern bench_vars_t bench_vars;
+
+static inline int var_Create(void *p_obj, const char *psz_name, int i_type)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name); VLC_UNUSED(i_type);
+    return VLC_SUCCESS;
+}
+
+static inline void var_Destroy(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name);
+}
+
+static inline int var_AddCallback(void *p_obj, const char *psz_name,
+                                  vlc_callback_t cb, void *data)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name); VLC_UNUSED(cb); VLC_UNUSED(data);
+    return VLC_SUCCESS;
+}
+
+static inline void var_DelCallback(void *p_obj, const char *psz_name,
+                                   vlc_callback_t cb, void *data)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name); VLC_UNUSED(cb); VLC_UNUSED(data);
+}
+
+static inline int var_CountChoices(void *p_obj, const char *psz_name)
+{
+    if (bench_vars.pf_count_choices != NULL)
+        return bench_vars.pf_count_choices(p_obj, psz_name);
+    return 0;
+}
+
+static inline int var_SetInteger(void *p_obj, const char *psz_name,
+                                 int64_t i_value)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name); VLC_UNUSED(i_value);
+    return VLC_SUCCESS;
+}
+
+static inline int var_SetString(void *p_obj, const char *psz_name,
+                                const char *psz_value)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name); VLC_UNUSED(psz_value);
+    return VLC_SUCCESS;
+}
+
+static inline int64_t var_GetInteger(void *p_obj, const char *psz_name)
+{
+    if (bench_vars.pf_get_integer != NULL)
+        return bench_vars.pf_get_integer(p_obj, psz_name);
+    return 0;
+}
+
+static inline float var_GetFloat(void *p_obj, const char *psz_name)
+{
+    if (bench_vars.pf_get_float != NULL)
+        return bench_vars.pf_get_float(p_obj, psz_name);
+    return 1.f;
+}
+
+static inline int64_t var_InheritInteger(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name);
+    return 0;
+}
+
+static inline bool var_InheritBool(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_name);
+    return false;
+}
+
+static inline char *var_InheritString(void *p_obj, const char *psz_name)
+{
+    if (bench_vars.pf_inherit_string != NULL)
+        return bench_vars.pf_inherit_string(p_obj, psz_name);
+    return NULL;
+}
+
+#endif
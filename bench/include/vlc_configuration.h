@@ -0,0 +1,19 @@
+#ifndef BENCH_VLC_CONFIGURATION_H
+#define BENCH_VLC_CONFIGURATION_H
+
+typedef enum vlc_userdir
+{
+    VLC_HOME_DIR,
+    VLC_CONFIG_DIR,
+    VLC_USERDATA_DIR,
+    VLC_CACHE_DIR,
+} vlc_userdir_t;
+
+/* no cache directory: the meta data cache stays closed */
+static inline char *config_GetUserDir(vlc_userdir_t type)
+{
+    VLC_UNUSED(type);
+    return NULL;
+}
+
+#endif
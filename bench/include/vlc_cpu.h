@@ -0,0 +1,7 @@
+#ifndef BENCH_VLC_CPU_H
+#define BENCH_VLC_CPU_H
+
+#define vlc_CPU_SSE2() __builtin_cpu_supports("sse2")
+#define vlc_CPU_AVX2() __builtin_cpu_supports("avx2")
+
+#endif
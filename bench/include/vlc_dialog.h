@@ -0,0 +1,12 @@
+#ifndef BENCH_VLC_DIALOG_H
+#define BENCH_VLC_DIALOG_H
+
+static inline VLC_FORMAT(3, 4)
+int vlc_dialog_display_error(void *p_obj, const char *psz_title,
+                             const char *psz_fmt, ...)
+{
+    VLC_UNUSED(p_obj); VLC_UNUSED(psz_title); VLC_UNUSED(psz_fmt);
+    return VLC_SUCCESS;
+}
+
+#endif
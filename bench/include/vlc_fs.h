@@ -0,0 +1,25 @@
+#ifndef BENCH_VLC_FS_H
+#define BENCH_VLC_FS_H
+
+#define vlc_open    open
+#define vlc_close   close
+#define vlc_fopen   fopen
+#define vlc_stat    stat
+#define vlc_rename  rename
+#define vlc_unlink  unlink
+#define vlc_mkdir   mkdir
+
+#include <dirent.h>
+
+static inline DIR *vlc_opendir(const char *psz_dir)
+{
+    return opendir(psz_dir);
+}
+
+static inline const char *vlc_readdir(DIR *p_dir)
+{
+    struct dirent *p_ent = readdir(p_dir);
+    return p_ent != NULL ? p_ent->d_name : NULL;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef BENCH_VLC_INPUT_H
+#define BENCH_VLC_INPUT_H
+
+#include <vlc_input_item.h>
+
+typedef struct input_thread_t
+{
+    input_item_t   *p_item;
+} input_thread_t;
+
+enum input_state_e
+{
+    INIT_S = 0,
+    OPENING_S,
+    PLAYING_S,
+    PAUSE_S,
+    END_S,
+    ERROR_S,
+};
+
+typedef enum input_event_type_e
+{
+    INPUT_EVENT_STATE,
+    INPUT_EVENT_DEAD,
+    INPUT_EVENT_RATE,
+    INPUT_EVENT_POSITION,
+    INPUT_EVENT_LENGTH,
+    INPUT_EVENT_ITEM_META,
+} input_event_type_e;
+
+static inline input_item_t *input_GetItem(input_thread_t *p_input)
+{
+    return p_input->p_item;
+}
+
+#endif
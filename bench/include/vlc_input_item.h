@@ -0,0 +1,80 @@
+#ifndef BENCH_VLC_INPUT_ITEM_H
+#define BENCH_VLC_INPUT_ITEM_H
+
+/* An item whose meta data the benchmark sets directly */
+typedef struct input_item_t
+{
+    vlc_mutex_t lock;           /**< zero-initialized by the benchmarks */
+    char       *psz_uri;
+    char       *psz_artist;
+    char       *psz_title;
+    char       *psz_album;
+    char       *psz_trackid;
+    char       *psz_tracknum;
+    char       *psz_nowplaying;
+    mtime_t     i_duration;
+    bool        b_net;
+    bool        b_unparsed;     /**< not preparsed yet */
+} input_item_t;
+
+typedef enum input_item_meta_request_option_t
+{
+    META_REQUEST_OPTION_NONE          = 0x00,
+    META_REQUEST_OPTION_SCOPE_LOCAL   = 0x01,
+    META_REQUEST_OPTION_SCOPE_NETWORK = 0x02,
+    META_REQUEST_OPTION_SCOPE_ANY     = 0x03,
+    META_REQUEST_OPTION_FETCH_LOCAL   = 0x04,
+} input_item_meta_request_option_t;
+
+/* like the core, the getters return a copy of the meta data */
+#define INPUT_ITEM_GETTER(name, field) \
+static inline char *input_item_Get##name(input_item_t *p_item) \
+{ \
+    return p_item->field ? strdup(p_item->field) : NULL; \
+}
+
+INPUT_ITEM_GETTER(URI, psz_uri)
+INPUT_ITEM_GETTER(Artist, psz_artist)
+INPUT_ITEM_GETTER(Title, psz_title)
+INPUT_ITEM_GETTER(Album, psz_album)
+INPUT_ITEM_GETTER(TrackID, psz_trackid)
+INPUT_ITEM_GETTER(TrackNum, psz_tracknum)
+INPUT_ITEM_GETTER(NowPlaying, psz_nowplaying)
+#undef INPUT_ITEM_GETTER
+
+static inline mtime_t input_item_GetDuration(input_item_t *p_item)
+{
+    return p_item->i_duration;
+}
+
+static inline bool input_item_IsPreparsed(input_item_t *p_item)
+{
+    return !p_item->b_unparsed;
+}
+
+static inline input_item_t *input_item_Hold(input_item_t *p_item)
+{
+    return p_item;
+}
+
+static inline void input_item_Release(input_item_t *p_item)
+{
+    VLC_UNUSED(p_item);
+}
+
+static inline int libvlc_MetadataRequest(libvlc_int_t *p_libvlc,
+                                         input_item_t *p_item,
+                                         input_item_meta_request_option_t i_opt,
+                                         int i_timeout, void *id)
+{
+    VLC_UNUSED(p_libvlc); VLC_UNUSED(p_item); VLC_UNUSED(i_opt);
+    VLC_UNUSED(i_timeout); VLC_UNUSED(id);
+    return VLC_SUCCESS;
+}
+
+static inline void libvlc_MetadataCancel(libvlc_int_t *p_libvlc, void *id)
+{
+    VLC_UNUSED(p_libvlc); VLC_UNUSED(id);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef BENCH_VLC_INTERFACE_H
+#define BENCH_VLC_INTERFACE_H
+
+typedef struct intf_sys_t intf_sys_t;
+
+typedef struct intf_thread_t
+{
+    struct
+    {
+        libvlc_int_t   *libvlc;
+    } obj;
+    intf_sys_t         *p_sys;
+} intf_thread_t;
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef BENCH_VLC_INTERRUPT_H
+#define BENCH_VLC_INTERRUPT_H
+
+#include <poll.h>
+
+typedef struct vlc_interrupt vlc_interrupt_t;
+
+static inline vlc_interrupt_t *vlc_interrupt_create(void)
+{
+    return NULL;
+}
+
+static inline void vlc_interrupt_destroy(vlc_interrupt_t *p_ctx)
+{
+    VLC_UNUSED(p_ctx);
+}
+
+static inline vlc_interrupt_t *vlc_interrupt_set(vlc_interrupt_t *p_ctx)
+{
+    VLC_UNUSED(p_ctx);
+    return NULL;
+}
+
+static inline void vlc_interrupt_kill(vlc_interrupt_t *p_ctx)
+{
+    VLC_UNUSED(p_ctx);
+}
+
+static inline void vlc_interrupt_raise(vlc_interrupt_t *p_ctx)
+{
+    VLC_UNUSED(p_ctx);
+}
+
+static inline int vlc_poll_i11e(struct pollfd *p_fds, unsigned i_fds,
+                                int i_timeout)
+{
+    return poll(p_fds, i_fds, i_timeout);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef BENCH_VLC_MEMSTREAM_H
+#define BENCH_VLC_MEMSTREAM_H
+
+/* A growable buffer, like the fallback of the core without open_memstream().
+ * Its allocations are counted as the plugin's. */
+struct vlc_memstream
+{
+    int         error;
+    char       *ptr;
+    size_t      length;
+    size_t      size;
+};
+
+static inline int vlc_memstream_open(struct vlc_memstream *ms)
+{
+    ms->error = 0;
+    ms->ptr = calloc(1, 1);
+    if (unlikely(ms->ptr == NULL))
+        ms->error = EOF;
+    ms->length = 0;
+    ms->size = 1;
+    return ms->error;
+}
+
+static inline size_t vlc_memstream_write(struct vlc_memstream *ms,
+                                         const void *ptr, size_t len)
+{
+    if (ms->error)
+        return 0;
+    if (ms->length + len + 1 > ms->size)
+    {
+        size_t i_size = __MAX(ms->length + len + 1, 2 * ms->size);
+        char *base = realloc(ms->ptr, i_size);
+        if (unlikely(base == NULL))
+        {
+            ms->error = EOF;
+            return 0;
+        }
+        ms->ptr = base;
+        ms->size = i_size;
+    }
+    memcpy(ms->ptr + ms->length, ptr, len);
+    ms->length += len;
+    ms->ptr[ms->length] = '\0';
+    return len;
+}
+
+static inline int vlc_memstream_putc(struct vlc_memstream *ms, int c)
+{
+    unsigned char b = c;
+    return vlc_memstream_write(ms, &b, 1) == 1 ? c : EOF;
+}
+
+static inline int vlc_memstream_puts(struct vlc_memstream *ms,
+                                     const char *str)
+{
+    size_t len = strlen(str);
+    return vlc_memstream_write(ms, str, len) == len ? 0 : EOF;
+}
+
+static inline VLC_FORMAT(2, 0)
+int vlc_memstream_vprintf(struct vlc_memstream *ms, const char *fmt,
+                          va_list args)
+{
+    va_list ap;
+
+    if (ms->error)
+        return EOF;
+
+    va_copy(ap, args);
+    int i_len = vsnprintf(ms->ptr + ms->length, ms->size - ms->length, fmt, ap);
+    va_end(ap);
+    if (i_len < 0)
+        goto error;
+
+    if (ms->length + i_len + 1 > ms->size)
+    {
+        size_t i_size = __MAX(ms->length + i_len + 1, 2 * ms->size);
+        char *base = realloc(ms->ptr, i_size);
+        if (unlikely(base == NULL))
+            goto error;
+        ms->ptr = base;
+        ms->size = i_size;
+        vsnprintf(ms->ptr + ms->length, ms->size - ms->length, fmt, args);
+    }
+    ms->length += i_len;
+    return i_len;
+
+error:
+    ms->error = EOF;
+    return EOF;
+}
+
+static inline VLC_FORMAT(2, 3)
+int vlc_memstream_printf(struct vlc_memstream *ms, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int i_ret = vlc_memstream_vprintf(ms, fmt, ap);
+    va_end(ap);
+    return i_ret;
+}
+
+static inline int vlc_memstream_close(struct vlc_memstream *ms)
+{
+    if (ms->error)
+    {
+        free(ms->ptr);
+        return EOF;
+    }
+    return 0;
+}
+
+#endif
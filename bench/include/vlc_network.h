@@ -0,0 +1,33 @@
+#ifndef BENCH_VLC_NETWORK_H
+#define BENCH_VLC_NETWORK_H
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+/* nothing is ever submitted by the benchmark */
+static inline int vlc_getaddrinfo_i11e(const char *psz_host, unsigned i_port,
+                                       const struct addrinfo *p_hints,
+                                       struct addrinfo **pp_res)
+{
+    VLC_UNUSED(psz_host); VLC_UNUSED(i_port); VLC_UNUSED(p_hints);
+    *pp_res = NULL;
+    return EAI_FAIL;
+}
+
+static inline int vlc_socket(int i_family, int i_type, int i_protocol,
+                             bool b_nonblock)
+{
+    VLC_UNUSED(b_nonblock);
+    return socket(i_family, i_type, i_protocol);
+}
+
+static inline int vlc_accept(int i_fd, struct sockaddr *p_addr,
+                             socklen_t *pi_len, bool b_nonblock)
+{
+    VLC_UNUSED(b_nonblock);
+    return accept(i_fd, p_addr, pi_len);
+}
+
+#define net_Close(fd) close(fd)
+#endif
@@ -0,0 +1,40 @@
+#ifndef BENCH_VLC_PLAYLIST_H
+#define BENCH_VLC_PLAYLIST_H
+
+typedef struct playlist_item_t
+{
+    input_item_t       *p_input;
+} playlist_item_t;
+
+typedef struct playlist_item_array_t
+{
+    playlist_item_t   **p_elems;
+    int                 i_size;
+} playlist_item_array_t;
+
+typedef struct playlist_t
+{
+    playlist_item_array_t current;
+    int                 i_current_index;
+} playlist_t;
+
+static inline playlist_t *pl_Get(void *p_obj)
+{
+    VLC_UNUSED(p_obj);
+    return NULL;
+}
+
+static inline void playlist_Lock(playlist_t *p_playlist)
+{
+    VLC_UNUSED(p_playlist);
+}
+
+static inline void playlist_Unlock(playlist_t *p_playlist)
+{
+    VLC_UNUSED(p_playlist);
+}
+
+#define PL_LOCK playlist_Lock(p_playlist)
+#define PL_UNLOCK playlist_Unlock(p_playlist)
+
+#endif
@@ -0,0 +1,29 @@
+/* The module descriptor is of no use to the benchmark. As the one of VLC, it
+ * still is a function referencing the callbacks of the module. */
+#ifndef BENCH_VLC_PLUGIN_H
+#define BENCH_VLC_PLUGIN_H
+
+#define vlc_module_begin() \
+    void bench_module(int (**)(vlc_object_t *), void (**)(vlc_object_t *)); \
+    void bench_module(int (**pf_activate)(vlc_object_t *), \
+                      void (**pf_deactivate)(vlc_object_t *)) {
+#define vlc_module_end() }
+#define set_shortname(name)
+#define set_description(desc)
+#define set_category(cat)
+#define set_subcategory(subcat)
+#define set_section(text, longtext)
+#define set_capability(cap, score)
+#define set_callbacks(activate, deactivate) \
+    *pf_activate = activate; *pf_deactivate = deactivate;
+#define add_string(name, value, text, longtext, advc)
+#define add_password(name, value, text, longtext)
+#define add_bool(name, value, text, longtext, advc)
+#define add_integer(name, value, text, longtext, advc)
+#define add_integer_with_range(name, value, min, max, text, longtext, advc)
+#define add_savefile(name, value, text, longtext)
+#define add_loadfile(name, value, text, longtext, advc)
+#define add_directory(name, value, text, longtext, advc)
+#define change_volatile()
+
+#endif
@@ -0,0 +1 @@
+/* Nothing the benchmark needs */
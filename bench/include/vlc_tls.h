@@ -0,0 +1,76 @@
+#ifndef BENCH_VLC_TLS_H
+#define BENCH_VLC_TLS_H
+
+/* nothing is ever submitted by the benchmark */
+typedef struct vlc_tls vlc_tls_t;
+typedef struct vlc_tls_creds vlc_tls_creds_t;
+
+static inline vlc_tls_creds_t *vlc_tls_ClientCreate(vlc_object_t *p_obj)
+{
+    VLC_UNUSED(p_obj);
+    return NULL;
+}
+
+static inline void vlc_tls_Delete(vlc_tls_creds_t *p_creds)
+{
+    VLC_UNUSED(p_creds);
+}
+
+static inline vlc_tls_t *vlc_tls_SocketOpenAddrInfo(const struct addrinfo *p_ai,
+                                                    bool b_defer_connect)
+{
+    VLC_UNUSED(p_ai); VLC_UNUSED(b_defer_connect);
+    return NULL;
+}
+
+static inline vlc_tls_t *vlc_tls_SocketOpen(int i_fd)
+{
+    VLC_UNUSED(i_fd);
+    return NULL;
+}
+
+static inline vlc_tls_t *vlc_tls_ClientSessionCreate(vlc_tls_creds_t *p_creds,
+                                                     vlc_tls_t *p_sock,
+                                                     const char *psz_host,
+                                                     const char *psz_service,
+                                                     const char *const *ppsz_alpn,
+                                                     char **ppsz_alp)
+{
+    VLC_UNUSED(p_creds); VLC_UNUSED(p_sock); VLC_UNUSED(psz_host);
+    VLC_UNUSED(psz_service); VLC_UNUSED(ppsz_alpn); VLC_UNUSED(ppsz_alp);
+    return NULL;
+}
+
+static inline ssize_t vlc_tls_Read(vlc_tls_t *p_tls, void *p_buf, size_t i_len,
+                                   bool b_waitall)
+{
+    VLC_UNUSED(p_tls); VLC_UNUSED(p_buf); VLC_UNUSED(i_len);
+    VLC_UNUSED(b_waitall);
+    return -1;
+}
+
+static inline ssize_t vlc_tls_Write(vlc_tls_t *p_tls, const void *p_buf,
+                                    size_t i_len)
+{
+    VLC_UNUSED(p_tls); VLC_UNUSED(p_buf); VLC_UNUSED(i_len);
+    return -1;
+}
+
+static inline int vlc_tls_GetFD(vlc_tls_t *p_tls)
+{
+    VLC_UNUSED(p_tls);
+    return -1;
+}
+
+static inline char *vlc_tls_GetLine(vlc_tls_t *p_tls)
+{
+    VLC_UNUSED(p_tls);
+    return NULL;
+}
+
+static inline void vlc_tls_Close(vlc_tls_t *p_tls)
+{
+    VLC_UNUSED(p_tls);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef BENCH_VLC_URL_H
+#define BENCH_VLC_URL_H
+
+typedef struct vlc_url_t
+{
+    char       *psz_protocol;
+    char       *psz_username;
+    char       *psz_password;
+    char       *psz_host;
+    unsigned    i_port;
+    char       *psz_path;
+    char       *psz_option;
+    char       *psz_buffer;
+    char       *psz_pathbuffer;
+} vlc_url_t;
+
+/* the benchmark fills the URL of its endpoint itself */
+static inline int vlc_UrlParse(vlc_url_t *p_url, const char *psz_url)
+{
+    VLC_UNUSED(psz_url);
+    memset(p_url, 0, sizeof(*p_url));
+    return VLC_EGENERIC;
+}
+
+static inline void vlc_UrlClean(vlc_url_t *p_url)
+{
+    VLC_UNUSED(p_url);
+}
+
+/* percent-encodes all but the unreserved characters, as the core does */
+static inline char *vlc_uri_encode(const char *psz)
+{
+    static const char hex[16] = "0123456789ABCDEF";
+    size_t i_len = strlen(psz);
+    char *psz_out = malloc(3 * i_len + 1), *p = psz_out;
+
+    if (unlikely(psz_out == NULL))
+        return NULL;
+    for (; *psz; psz++)
+    {
+        unsigned char c = *psz;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+         || (c >= '0' && c <= '9') || strchr("-._~", c) != NULL)
+            *p++ = c;
+        else
+        {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        }
+    }
+    *p++ = '\0';
+
+    char *psz_ret = realloc(psz_out, p - psz_out);
+    return psz_ret ? psz_ret : psz_out;
+}
+
+static inline char *vlc_uri_decode(char *psz)
+{
+    char *in = psz, *out = psz;
+
+    while (*in)
+    {
+        if (*in == '%')
+        {
+            unsigned c;
+            if (sscanf(in + 1, "%2x", &c) != 1)
+                return NULL;
+            *out++ = c;
+            in += 3;
+        }
+        else
+            *out++ = *in++;
+    }
+    *out = '\0';
+    return psz;
+}
+
+static inline char *vlc_uri_decode_duplicate(const char *psz)
+{
+    char *psz_dup = strdup(psz);
+    if (psz_dup != NULL && vlc_uri_decode(psz_dup) == NULL)
+        FREENULL(psz_dup);
+    return psz_dup;
+}
+
+static inline char *vlc_uri2path(const char *psz_uri)
+{
+    if (strncmp(psz_uri, "file://", 7))
+        return NULL;
+    return vlc_uri_decode_duplicate(psz_uri + 7);
+}
+
+#endif
@@ -0,0 +1,426 @@
+/*****************************************************************************
+ * load.c : playback load generator for the listenbrainz plugin
+ *****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * Generated playback sessions are fed to the ItemChange and PlayingChange
+ * callbacks of the plugin, as the playlist and the inputs of VLC 3.0 would,
+ * while a consumer thread drains the queue like a submission thread. The
+ * playback itself follows the simulated clock of bench_clock.h, so hours of
+ * listening take as long as the callbacks, or the requested event rate.
+ *
+ * Reported: the latency percentiles of the callbacks, the contention on the
+ * locks of the plugin, and what became of the tracks: queued as listens,
+ * dropped with a full queue, or rejected (too short, skipped). With -w, the
+ * events are recorded as with --listenbrainz-record-file, for bench/replay.
+ */
+
+#include "../vlc-3.0/listenbrainz.c"
+
+#include <getopt.h>
+
+bench_allocs_t bench_allocs;
+bench_locks_t bench_locks;
+bench_vars_t bench_vars;
+mtime_t bench_clock = 1700000000 * CLOCK_FREQ;
+
+/* Playback pattern of a scenario, in seconds */
+typedef struct load_scenario_t
+{
+    const char *psz_name;
+    int         i_min_length;       /**< track lengths */
+    int         i_max_length;
+    int         i_play;             /**< played before skipping, 0 for all */
+    int         i_pause_every;      /**< played between pauses, 0 for none */
+    int         i_min_pause;        /**< pause lengths */
+    int         i_max_pause;
+} load_scenario_t;
+
+static const load_scenario_t p_scenarios[] = {
+    { "playlist", 180, 420, 0,  0,  0,   0 },   /* huge playlist, all played */
+    { "skip",     180, 420, 3,  0,  0,   0 },   /* rapid skipping */
+    { "short",    15,  45,  0,  0,  0,   0 },   /* thousands of short tracks */
+    { "pause",    240, 420, 0,  20, 1, 150 },   /* pause/resume storms */
+};
+
+/* State of the simulated input, as read through its variables */
+static struct
+{
+    int         i_state;
+    mtime_t     i_time;
+} input_state;
+
+static int64_t GetInteger(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj);
+    if (!strcmp(psz_name, "state"))
+        return input_state.i_state;
+    if (!strcmp(psz_name, "time"))
+        return input_state.i_time;
+    return 0;
+}
+
+static const char *psz_record_file;
+
+static char *InheritString(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj);
+    if (psz_record_file != NULL && !strcmp(psz_name, "listenbrainz-record-file"))
+        return strdup(psz_record_file);
+    return NULL;
+}
+
+typedef struct load_t
+{
+    intf_thread_t          *p_intf;
+    const load_scenario_t  *p_scenario;
+    int                     i_tracks;
+    unsigned                i_rate;         /**< events/s, 0 for no limit */
+    mtime_t                 i_step;         /**< between position events */
+    useconds_t              i_drain;        /**< time a submission takes */
+    uint64_t                i_seed;
+
+    uint32_t               *pi_latency;     /**< of each callback, in ns */
+    size_t                  i_events;
+    size_t                  i_size;
+    uint64_t                i_start;
+
+    bool                    b_stop;         /**< p_sys->lock */
+} load_t;
+
+static unsigned Random(load_t *p_load, int i_min, int i_max)
+{
+    /* xorshift64, for sessions reproducible from their seed */
+    p_load->i_seed ^= p_load->i_seed << 13;
+    p_load->i_seed ^= p_load->i_seed >> 7;
+    p_load->i_seed ^= p_load->i_seed << 17;
+    return i_min + p_load->i_seed % (i_max - i_min + 1);
+}
+
+static void Record(load_t *p_load, uint64_t i_ns)
+{
+    if (p_load->i_events == p_load->i_size)
+    {
+        p_load->i_size = p_load->i_size ? 2 * p_load->i_size : 4096;
+        p_load->pi_latency = (realloc)(p_load->pi_latency,
+                                       p_load->i_size * sizeof(uint32_t));
+        if (p_load->pi_latency == NULL)
+            abort();
+    }
+    p_load->pi_latency[p_load->i_events++] = __MIN(i_ns, UINT32_MAX);
+
+    /* pace the events at the requested rate */
+    if (p_load->i_rate)
+    {
+        uint64_t i_due = p_load->i_start
+                       + p_load->i_events * UINT64_C(1000000000) / p_load->i_rate;
+        uint64_t i_now = bench_ns();
+        if (i_due > i_now)
+            usleep((i_due - i_now) / 1000);
+    }
+}
+
+static void Switch(load_t *p_load, input_thread_t *p_input)
+{
+    vlc_value_t oldval = { .p_address = NULL };
+    vlc_value_t newval = { .p_address = p_input };
+
+    uint64_t i_start = bench_ns();
+    ItemChange(NULL, "input-current", oldval, newval, p_load->p_intf);
+    Record(p_load, bench_ns() - i_start);
+}
+
+static void Fire(load_t *p_load, input_thread_t *p_input, int i_event)
+{
+    vlc_value_t oldval = { .i_int = 0 };
+    vlc_value_t newval = { .i_int = i_event };
+
+    uint64_t i_start = bench_ns();
+    PlayingChange(VLC_OBJECT(p_input), "intf-event", oldval, newval,
+                  p_load->p_intf);
+    Record(p_load, bench_ns() - i_start);
+}
+
+static void SetState(load_t *p_load, input_thread_t *p_input, int i_state)
+{
+    input_state.i_state = i_state;
+    Fire(p_load, p_input, INPUT_EVENT_STATE);
+}
+
+/* Let the simulated clock and the media time run for i_length seconds */
+static void Play(load_t *p_load, input_thread_t *p_input, int i_length)
+{
+    mtime_t i_end = input_state.i_time + i_length * CLOCK_FREQ;
+
+    while (input_state.i_time < i_end)
+    {
+        mtime_t i_step = __MIN(p_load->i_step, i_end - input_state.i_time);
+        __atomic_fetch_add(&bench_clock, i_step, __ATOMIC_RELAXED);
+        input_state.i_time += i_step;
+        Fire(p_load, p_input, INPUT_EVENT_POSITION);
+    }
+}
+
+static void PlayTrack(load_t *p_load, input_item_t *p_item)
+{
+    const load_scenario_t  *p_scenario = p_load->p_scenario;
+    input_thread_t          input = { .p_item = p_item };
+    int                     i_length = p_item->i_duration / CLOCK_FREQ;
+    int                     i_play = p_scenario->i_play ? p_scenario->i_play
+                                                        : i_length;
+
+    input_state.i_state = OPENING_S;
+    input_state.i_time = 0;
+    Switch(p_load, &input);
+    SetState(p_load, &input, PLAYING_S);
+
+    for (int i_played = 0; i_played < i_play; )
+    {
+        int i_chunk = i_play - i_played;
+        if (p_scenario->i_pause_every)
+            i_chunk = __MIN(i_chunk, p_scenario->i_pause_every);
+        Play(p_load, &input, i_chunk);
+        i_played += i_chunk;
+
+        if (p_scenario->i_pause_every && i_played < i_play)
+        {
+            SetState(p_load, &input, PAUSE_S);
+            __atomic_fetch_add(&bench_clock, CLOCK_FREQ
+                * Random(p_load, p_scenario->i_min_pause, p_scenario->i_max_pause),
+                __ATOMIC_RELAXED);
+            SetState(p_load, &input, PLAYING_S);
+        }
+    }
+
+    /* skipped tracks are left for the next one, as on a playlist change */
+    if (!p_scenario->i_play)
+        SetState(p_load, &input, END_S);
+}
+
+/* Drain the queue like a submission thread which takes i_drain per request */
+static void *Consume(void *data)
+{
+    load_t                  *p_load = data;
+    intf_sys_t              *p_sys = p_load->p_intf->p_sys;
+    listenbrainz_endpoint_t *p_ep = &p_sys->p_endpoints[0];
+    struct vlc_memstream    payload, req;
+
+    vlc_mutex_lock(&p_sys->lock);
+    for (;;)
+    {
+        while (!p_load->b_stop
+            && p_ep->i_next >= p_sys->i_queue_base + p_sys->i_songs)
+            vlc_cond_wait(&p_sys->wait, &p_sys->lock);
+        if (p_ep->i_next >= p_sys->i_queue_base + p_sys->i_songs)
+            break;
+
+        uint64_t i_first = p_ep->i_next;
+        int i_batch = p_sys->i_queue_base + p_sys->i_songs - i_first;
+        int i_ret = ForgePayload(p_sys, i_first, i_batch, &payload);
+        vlc_mutex_unlock(&p_sys->lock);
+
+        if (i_ret == 0)
+        {
+            if (ForgeRequest(p_ep, &payload, false, &req) == 0)
+                free(req.ptr);
+            free(payload.ptr);
+        }
+        if (p_load->i_drain)
+            usleep(p_load->i_drain);
+
+        vlc_mutex_lock(&p_sys->lock);
+        p_ep->i_next = i_first + i_batch;
+        TrimQueue(p_sys);
+        p_sys->pi_metrics[METRIC_SUBMITS]++;
+        p_sys->pi_metrics[METRIC_LISTENS] += i_batch;
+    }
+    vlc_mutex_unlock(&p_sys->lock);
+    return NULL;
+}
+
+static int CompareLatency(const void *a, const void *b)
+{
+    uint32_t i_a = *(const uint32_t *) a, i_b = *(const uint32_t *) b;
+    return (i_a > i_b) - (i_a < i_b);
+}
+
+static uint32_t Percentile(const load_t *p_load, double f_rank)
+{
+    if (p_load->i_events == 0)
+        return 0;
+    return p_load->pi_latency[(size_t) (f_rank * (p_load->i_events - 1))];
+}
+
+static int Run_Scenario(load_t *p_load)
+{
+    intf_thread_t           intf = { .obj = { .libvlc = NULL } };
+    listenbrainz_endpoint_t ep = {
+        .url = { .psz_host = "localhost", .psz_path = "/1/submit-listens" },
+        .psz_token = "00000000-0000-0000-0000-000000000000",
+        .i_token = TOKEN_VALID,
+        .p_intf = &intf,
+    };
+    input_item_t            *p_items;
+    vlc_thread_t            consumer;
+
+    intf_sys_t *p_sys = (calloc)(1, sizeof(*p_sys));
+    p_items = (calloc)(p_load->i_tracks, sizeof(*p_items));
+    if (p_sys == NULL || p_items == NULL)
+        return VLC_ENOMEM;
+    intf.p_sys = p_sys;
+    vlc_mutex_init(&p_sys->lock);
+    vlc_cond_init(&p_sys->wait);
+    vlc_cond_init(&p_sys->import_wait);
+    vlc_mutex_init(&p_sys->trace_lock);
+    p_sys->p_endpoints = &ep;
+    p_sys->i_endpoints = 1;
+    RecordOpen(&intf);
+
+    for (int i = 0; i < p_load->i_tracks; i++)
+    {
+        input_item_t *p_item = &p_items[i];
+        if ((asprintf)(&p_item->psz_uri, "file:///music/%d.flac", i) < 0
+         || (asprintf)(&p_item->psz_artist, "Artist %d", i % 997) < 0
+         || (asprintf)(&p_item->psz_title, "Title %d", i) < 0)
+            return VLC_ENOMEM;
+        p_item->psz_album = "Album";
+        p_item->i_duration = CLOCK_FREQ * Random(p_load,
+            p_load->p_scenario->i_min_length, p_load->p_scenario->i_max_length);
+    }
+
+    p_load->p_intf = &intf;
+    p_load->i_events = 0;
+    p_load->b_stop = false;
+    memset(&bench_locks, 0, sizeof(bench_locks));
+    if (vlc_clone(&consumer, Consume, p_load, VLC_THREAD_PRIORITY_LOW))
+        return VLC_EGENERIC;
+
+    p_load->i_start = bench_ns();
+    for (int i = 0; i < p_load->i_tracks; i++)
+        PlayTrack(p_load, &p_items[i]);
+
+    /* the last input goes away, as when the playlist stops */
+    Switch(p_load, NULL);
+    uint64_t i_ns = bench_ns() - p_load->i_start;
+    bench_locks_t locks = bench_locks;
+
+    vlc_mutex_lock(&p_sys->lock);
+    p_load->b_stop = true;
+    vlc_cond_broadcast(&p_sys->wait);
+    vlc_mutex_unlock(&p_sys->lock);
+    vlc_join(consumer, NULL);
+
+    qsort(p_load->pi_latency, p_load->i_events, sizeof(uint32_t),
+          CompareLatency);
+    uint64_t i_queued = p_sys->i_queue_base + p_sys->i_songs;
+    uint64_t i_dropped = p_sys->pi_metrics[METRIC_DROPS];
+
+    printf("%-9s %7d %9zu %10.0f %7"PRIu32" %7"PRIu32" %7"PRIu32" %8"PRIu32
+           " %10"PRIu64" %9.2f %8"PRIu64" %7"PRIu64" %8"PRIu64"\n",
+           p_load->p_scenario->psz_name, p_load->i_tracks, p_load->i_events,
+           p_load->i_events * 1e9 / i_ns,
+           Percentile(p_load, .5), Percentile(p_load, .99),
+           Percentile(p_load, .999), Percentile(p_load, 1.),
+           locks.i_waits, locks.i_wait_ns / 1e6, i_queued, i_dropped,
+           p_load->i_tracks - __MIN(i_queued + i_dropped,
+                                    (uint64_t) p_load->i_tracks));
+
+    for (int i = 0; i < p_sys->i_songs; i++)
+        DeleteListen(p_sys, &p_sys->p_queue[i]);
+    DeleteSong(&p_sys->p_current_song);
+    free(p_sys->strings.pp_buckets);
+    for (int i = 0; i < p_load->i_tracks; i++)
+    {
+        free(p_items[i].psz_uri);
+        free(p_items[i].psz_artist);
+        free(p_items[i].psz_title);
+    }
+    free(p_items);
+    vlc_cond_destroy(&p_sys->wait);
+    vlc_cond_destroy(&p_sys->import_wait);
+    RecordClose(p_sys);
+    vlc_mutex_destroy(&p_sys->trace_lock);
+    vlc_mutex_destroy(&p_sys->lock);
+    free(p_sys);
+    return VLC_SUCCESS;
+}
+
+static void Usage(const char *psz_name)
+{
+    fprintf(stderr, "Usage: %s [-s scenario] [-n tracks] [-r events/s] "
+            "[-p position period (ms)] [-d submission time (us)] [-S seed] "
+            "[-w record file]\n"
+            "Scenarios:", psz_name);
+    for (size_t i = 0; i < ARRAY_SIZE(p_scenarios); i++)
+        fprintf(stderr, " %s", p_scenarios[i].psz_name);
+    fprintf(stderr, ", all of them by default\n");
+}
+
+int main(int argc, char **argv)
+{
+    load_t      load = {
+        .i_tracks = 2000,
+        .i_step = CLOCK_FREQ / 4,
+        .i_seed = 42,
+    };
+    const char *psz_scenario = NULL;
+    int         c;
+
+    while ((c = getopt(argc, argv, "s:n:r:p:d:S:w:h")) != -1)
+    {
+        switch (c)
+        {
+            case 's': psz_scenario = optarg; break;
+            case 'n': load.i_tracks = atoi(optarg); break;
+            case 'r': load.i_rate = strtoul(optarg, NULL, 10); break;
+            case 'p': load.i_step = atoi(optarg) * INT64_C(1000); break;
+            case 'd': load.i_drain = strtoul(optarg, NULL, 10); break;
+            case 'S': load.i_seed = strtoull(optarg, NULL, 10) | 1; break;
+            case 'w': psz_record_file = optarg; break;
+            default:
+                Usage(argv[0]);
+                return c != 'h';
+        }
+    }
+    if (load.i_tracks <= 0 || load.i_step <= 0)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    bench_vars.pf_get_integer = GetInteger;
+    bench_vars.pf_inherit_string = InheritString;
+
+    printf("%-9s %7s %9s %10s %7s %7s %7s %8s %10s %9s %8s %7s %8s\n",
+           "scenario", "tracks", "events", "events/s", "p50 ns", "p99 ns",
+           "p99.9ns", "max ns", "lock waits", "waited ms", "queued",
+           "dropped", "rejected");
+    for (size_t i = 0; i < ARRAY_SIZE(p_scenarios); i++)
+    {
+        if (psz_scenario && strcmp(psz_scenario, p_scenarios[i].psz_name))
+            continue;
+        load.p_scenario = &p_scenarios[i];
+        if (Run_Scenario(&load))
+        {
+            fprintf(stderr, "%s failed\n", p_scenarios[i].psz_name);
+            return 1;
+        }
+    }
+    (free)(load.pi_latency);
+    return 0;
+}
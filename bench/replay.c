@@ -0,0 +1,382 @@
+/*****************************************************************************
+ * replay.c : replay of recorded playback sessions on the listenbrainz plugin
+ *****************************************************************************
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*
+ * The events of a file written by --listenbrainz-record-file are fed back to
+ * the ItemChange and PlayingChange callbacks, at full speed: the input and its
+ * item answer as they did when recorded, and the simulated clock of
+ * bench_clock.h jumps from the date of an event to the next. The listens
+ * queued are printed in order on the standard output and the timings of the
+ * callbacks on the standard error, so that the outputs of two builds can be
+ * compared with diff.
+ *
+ * Only records of the VLC 3.0 plugin can be replayed: the stubs model its
+ * core.
+ */
+
+#include "../vlc-3.0/listenbrainz.c"
+
+#include <getopt.h>
+
+bench_allocs_t bench_allocs;
+bench_locks_t bench_locks;
+bench_vars_t bench_vars;
+mtime_t bench_clock;
+
+static const char *const ppsz_events[] = {
+    [RECORD_ITEM]       = "item",
+    [RECORD_STATE]      = "state",
+    [RECORD_POSITION]   = "position",
+    [RECORD_ITEM_META]  = "meta",
+};
+
+/* The input being replayed, as recorded by the last event */
+static struct
+{
+    input_thread_t  input;
+    input_item_t    item;
+    const listenbrainz_record_t *p_rec;
+} replay_state;
+
+static int64_t GetInteger(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj);
+    if (!strcmp(psz_name, "state"))
+        return replay_state.p_rec->i_state;
+    if (!strcmp(psz_name, "time"))
+        return replay_state.p_rec->i_time;
+    return 0;
+}
+
+static float GetFloat(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj);
+    if (!strcmp(psz_name, "rate"))
+        return replay_state.p_rec->f_rate;
+    return 1.f;
+}
+
+static int CountChoices(void *p_obj, const char *psz_name)
+{
+    VLC_UNUSED(p_obj);
+    if (!strcmp(psz_name, "video-es"))
+        return !!(replay_state.p_rec->i_flags & RECORD_VIDEO);
+    return 0;
+}
+
+/* An event, realigned, and its meta data in the record file */
+typedef struct replay_event_t
+{
+    listenbrainz_record_t   rec;
+    const char             *p_meta;
+} replay_event_t;
+
+typedef struct replay_t
+{
+    char                    *p_data;        /**< the whole record file */
+    replay_event_t          *p_events;      /**< its events */
+    size_t                  i_events;
+    mtime_t                 i_offset;       /**< from the recorded clock
+                                             * to the epoch */
+
+    uint32_t               *pi_latency;     /**< of each callback, in ns,
+                                             * for each round */
+    int                     i_rounds;
+} replay_t;
+
+static int Load(replay_t *p_replay, const char *psz_file)
+{
+    FILE *p_file = fopen(psz_file, "rb");
+    if (p_file == NULL)
+    {
+        fprintf(stderr, "cannot read %s: %s\n", psz_file, strerror(errno));
+        return VLC_EGENERIC;
+    }
+
+    size_t i_size = 0;
+    for (;;)
+    {
+        char *p_data = (realloc)(p_replay->p_data, i_size + 65536);
+        if (p_data == NULL)
+        {
+            fclose(p_file);
+            return VLC_ENOMEM;
+        }
+        p_replay->p_data = p_data;
+        size_t i_read = fread(p_data + i_size, 1, 65536, p_file);
+        i_size += i_read;
+        if (i_read < 65536)
+            break;
+    }
+    fclose(p_file);
+
+    listenbrainz_record_header_t header;
+    if (i_size < sizeof(header))
+        goto error;
+    memcpy(&header, p_replay->p_data, sizeof(header));
+    if (memcmp(header.psz_magic, RECORD_MAGIC, sizeof(header.psz_magic)))
+    {
+        fprintf(stderr, "%s: not a record of the VLC 3.0 plugin\n", psz_file);
+        return VLC_EGENERIC;
+    }
+    p_replay->i_offset = header.i_epoch * CLOCK_FREQ - header.i_clock;
+
+    size_t i_max = (i_size - sizeof(header)) / sizeof(listenbrainz_record_t);
+    p_replay->p_events = (malloc)(i_max * sizeof(replay_event_t) + 1);
+    if (p_replay->p_events == NULL)
+        return VLC_ENOMEM;
+
+    for (size_t i_pos = sizeof(header); i_pos < i_size; )
+    {
+        replay_event_t *p_event = &p_replay->p_events[p_replay->i_events];
+
+        /* events follow each other in the file, unaligned */
+        if (i_size - i_pos < sizeof(p_event->rec))
+            goto error;
+        memcpy(&p_event->rec, p_replay->p_data + i_pos, sizeof(p_event->rec));
+        i_pos += sizeof(p_event->rec);
+        if (p_event->rec.i_event >= ARRAY_SIZE(ppsz_events)
+         || i_size - i_pos < p_event->rec.i_size)
+            goto error;
+        p_event->p_meta = p_replay->p_data + i_pos;
+
+        /* the meta data must hold all its strings, terminated */
+        int i_strings = 0;
+        for (uint32_t i = 0; i < p_event->rec.i_size; i++)
+            i_strings += p_event->p_meta[i] == '\0';
+        if (p_event->rec.i_size && (i_strings != RECORD_META
+         || p_event->p_meta[p_event->rec.i_size - 1] != '\0'))
+            goto error;
+        i_pos += p_event->rec.i_size;
+        p_replay->i_events++;
+    }
+    return VLC_SUCCESS;
+
+error:
+    fprintf(stderr, "%s: truncated or corrupt record\n", psz_file);
+    return VLC_EGENERIC;
+}
+
+/* Let the item answer with the meta data of an event */
+static void SetItem(const replay_event_t *p_event)
+{
+    const char *p_meta = p_event->p_meta;
+    input_item_t *p_item = &replay_state.item;
+    char **pppsz_meta[RECORD_META] = {
+        &p_item->psz_uri, &p_item->psz_artist, &p_item->psz_title,
+        &p_item->psz_album, &p_item->psz_trackid, &p_item->psz_tracknum,
+        &p_item->psz_nowplaying,
+    };
+
+    for (int i = 0; i < RECORD_META; i++)
+    {
+        *pppsz_meta[i] = *p_meta ? (char *) p_meta : NULL;
+        p_meta += strlen(p_meta) + 1;
+    }
+    p_item->i_duration = p_event->rec.i_length;
+    p_item->b_net = p_event->rec.i_flags & RECORD_NET;
+    p_item->b_unparsed = !(p_event->rec.i_flags & RECORD_PREPARSED);
+}
+
+/* Take the listens queued, like a submission thread would */
+static void Drain(intf_sys_t *p_sys, bool b_print)
+{
+    listenbrainz_endpoint_t *p_ep = &p_sys->p_endpoints[0];
+    struct vlc_memstream    json;
+
+    vlc_mutex_lock(&p_sys->lock);
+    for (uint64_t i = p_ep->i_next; b_print
+         && i < p_sys->i_queue_base + p_sys->i_songs; i++)
+    {
+        vlc_memstream_open(&json);
+        PutListen(&json, &p_sys->p_queue[i - p_sys->i_queue_base]);
+        if (vlc_memstream_close(&json) == 0)
+        {
+            puts(json.ptr);
+            free(json.ptr);
+        }
+    }
+    p_ep->i_next = p_sys->i_queue_base + p_sys->i_songs;
+    TrimQueue(p_sys);
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+static int Replay(replay_t *p_replay, uint32_t *pi_latency, bool b_print)
+{
+    intf_thread_t           intf = { .obj = { .libvlc = NULL } };
+    listenbrainz_endpoint_t ep = {
+        .url = { .psz_host = "localhost", .psz_path = "/1/submit-listens" },
+        .psz_token = "00000000-0000-0000-0000-000000000000",
+        .i_token = TOKEN_VALID,
+        .p_intf = &intf,
+    };
+    vlc_value_t             oldval = { .i_int = 0 }, newval;
+
+    intf_sys_t *p_sys = (calloc)(1, sizeof(*p_sys));
+    if (p_sys == NULL)
+        return VLC_ENOMEM;
+    intf.p_sys = p_sys;
+    vlc_mutex_init(&p_sys->lock);
+    vlc_cond_init(&p_sys->wait);
+    vlc_cond_init(&p_sys->import_wait);
+    vlc_mutex_init(&p_sys->trace_lock);
+    p_sys->p_endpoints = &ep;
+    p_sys->i_endpoints = 1;
+
+    replay_state.input.p_item = &replay_state.item;
+    for (size_t i = 0; i < p_replay->i_events; i++)
+    {
+        const listenbrainz_record_t *p_rec = &p_replay->p_events[i].rec;
+        input_thread_t *p_input = &replay_state.input;
+
+        replay_state.p_rec = p_rec;
+        bench_clock = p_rec->i_date + p_replay->i_offset;
+        if (p_rec->i_size)
+            SetItem(&p_replay->p_events[i]);
+
+        uint64_t i_start = bench_ns();
+        switch (p_rec->i_event)
+        {
+            case RECORD_ITEM:
+                /* an input without item is recorded as no input at all */
+                newval.p_address = p_rec->i_size ? p_input : NULL;
+                ItemChange(NULL, "input-current", oldval, newval, &intf);
+                break;
+            case RECORD_STATE:
+                newval.i_int = INPUT_EVENT_STATE;
+                PlayingChange(VLC_OBJECT(p_input), "intf-event", oldval,
+                              newval, &intf);
+                break;
+            case RECORD_POSITION:
+                newval.i_int = INPUT_EVENT_POSITION;
+                PlayingChange(VLC_OBJECT(p_input), "intf-event", oldval,
+                              newval, &intf);
+                break;
+            case RECORD_ITEM_META:
+                newval.i_int = INPUT_EVENT_ITEM_META;
+                PlayingChange(VLC_OBJECT(p_input), "intf-event", oldval,
+                              newval, &intf);
+                break;
+        }
+        pi_latency[i] = __MIN(bench_ns() - i_start, UINT32_MAX);
+
+        Drain(p_sys, b_print);
+    }
+
+    for (int i = 0; i < p_sys->i_songs; i++)
+        DeleteListen(p_sys, &p_sys->p_queue[i]);
+    DeleteSong(&p_sys->p_current_song);
+    free(p_sys->psz_stream_np);
+    free(p_sys->psz_stream_a);
+    free(p_sys->psz_stream_t);
+    free(p_sys->strings.pp_buckets);
+    vlc_cond_destroy(&p_sys->wait);
+    vlc_cond_destroy(&p_sys->import_wait);
+    vlc_mutex_destroy(&p_sys->trace_lock);
+    vlc_mutex_destroy(&p_sys->lock);
+    free(p_sys);
+    return VLC_SUCCESS;
+}
+
+static int CompareLatency(const void *a, const void *b)
+{
+    uint32_t i_a = *(const uint32_t *) a, i_b = *(const uint32_t *) b;
+    return (i_a > i_b) - (i_a < i_b);
+}
+
+/* Timings of each kind of event, over all the rounds */
+static void Report(const replay_t *p_replay)
+{
+    uint32_t *pi_sorted = (malloc)(p_replay->i_events * p_replay->i_rounds
+                                   * sizeof(uint32_t));
+    if (pi_sorted == NULL)
+        return;
+
+    fprintf(stderr, "%-9s %8s %10s %8s %8s %8s %10s\n", "event", "count",
+            "mean ns", "p50 ns", "p99 ns", "max ns", "total us");
+    for (size_t i_event = 0; i_event < ARRAY_SIZE(ppsz_events); i_event++)
+    {
+        size_t i_count = 0;
+        uint64_t i_total = 0;
+
+        for (int i_round = 0; i_round < p_replay->i_rounds; i_round++)
+            for (size_t i = 0; i < p_replay->i_events; i++)
+                if (p_replay->p_events[i].rec.i_event == i_event)
+                {
+                    uint32_t i_ns = p_replay->pi_latency[i_round * p_replay->i_events + i];
+                    pi_sorted[i_count++] = i_ns;
+                    i_total += i_ns;
+                }
+        if (i_count == 0)
+            continue;
+
+        qsort(pi_sorted, i_count, sizeof(uint32_t), CompareLatency);
+        fprintf(stderr, "%-9s %8zu %10.0f %8"PRIu32" %8"PRIu32" %8"PRIu32
+                " %10.1f\n", ppsz_events[i_event], i_count / p_replay->i_rounds,
+                (double) i_total / i_count, pi_sorted[i_count / 2],
+                pi_sorted[(i_count - 1) * 99 / 100], pi_sorted[i_count - 1],
+                i_total / 1e3 / p_replay->i_rounds);
+    }
+    (free)(pi_sorted);
+}
+
+int main(int argc, char **argv)
+{
+    replay_t    replay = { .i_rounds = 1 };
+    int         c;
+
+    while ((c = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': replay.i_rounds = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds] RECORD\n", argv[0]);
+                return c != 'h';
+        }
+    }
+    if (optind != argc - 1 || replay.i_rounds <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-n rounds] RECORD\n", argv[0]);
+        return 1;
+    }
+
+    if (Load(&replay, argv[optind]))
+        return 1;
+
+    bench_vars.pf_get_integer = GetInteger;
+    bench_vars.pf_get_float = GetFloat;
+    bench_vars.pf_count_choices = CountChoices;
+
+    replay.pi_latency = (malloc)(replay.i_events * replay.i_rounds
+                                 * sizeof(uint32_t) + 1);
+    if (replay.pi_latency == NULL)
+        return 1;
+
+    /* the listens of the first round only, they are the same every time */
+    for (int i = 0; i < replay.i_rounds; i++)
+        if (Replay(&replay, replay.pi_latency + i * replay.i_events, i == 0))
+            return 1;
+    Report(&replay);
+
+    (free)(replay.p_events);
+    (free)(replay.pi_latency);
+    (free)(replay.p_data);
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*****************************************************************************
+ * listenbrainz-helper.c : submit the listens of VLC out of its process
+ *****************************************************************************
+ * The helper hosts the listenbrainz plugin in a libVLC instance of its own,
+ * playing nothing, which accepts the listens of the VLC instances started
+ * with --listenbrainz-helper=SOCKET and submits them with its own settings.
+ * Neither the TLS handshakes nor the retries then run in the player, and
+ * what is queued outlives it.
+ *
+ *   listenbrainz-helper SOCKET [VLC OPTIONS...]
+ *
+ * e.g. listenbrainz-helper /run/user/1000/listenbrainz \
+ *          --listenbrainz-spool=$HOME/.cache/listenbrainz
+ *
+ * The players keep their listens until the helper acknowledges them
+ * spooled, so the helper always spools what it accepts: without
+ * --listenbrainz-spool, it spools in $XDG_CACHE_HOME/listenbrainz-helper
+ * (~/.cache/listenbrainz-helper).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <vlc/vlc.h>
+
+/* the default spool, in the cache directory of the user, or NULL */
+static char *DefaultSpool(void)
+{
+    const char *psz_cache = getenv("XDG_CACHE_HOME");
+    const char *psz_home = getenv("HOME");
+    const char *psz_sub = "";
+
+    if (psz_cache == NULL || psz_cache[0] != '/')
+    {
+        if (psz_home == NULL || psz_home[0] == '\0')
+            return NULL;
+        psz_cache = psz_home;
+        psz_sub = "/.cache";
+    }
+
+    size_t i_spool = sizeof("--listenbrainz-spool=/listenbrainz-helper")
+                   + strlen(psz_cache) + strlen(psz_sub);
+    char *psz_spool = malloc(i_spool);
+    if (psz_spool == NULL)
+        return NULL;
+
+    /* the cache directory itself may not exist yet, the spool is made */
+    int i_dir = snprintf(psz_spool, i_spool, "--listenbrainz-spool=%s%s",
+                         psz_cache, psz_sub);
+    mkdir(psz_spool + i_dir - strlen(psz_cache) - strlen(psz_sub), 0700);
+    snprintf(psz_spool + i_dir, i_spool - i_dir, "/listenbrainz-helper");
+    return psz_spool;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s SOCKET [VLC OPTIONS...]\n", argv[0]);
+        return 2;
+    }
+
+    /* the player options of the user, then the spool and the socket */
+    const char **ppsz_args = malloc((argc + 3) * sizeof(*ppsz_args));
+    size_t i_serve = sizeof("--listenbrainz-serve=") + strlen(argv[1]);
+    char *psz_serve = malloc(i_serve);
+    if (ppsz_args == NULL || psz_serve == NULL)
+        return 1;
+    snprintf(psz_serve, i_serve, "--listenbrainz-serve=%s", argv[1]);
+
+    int i_args = 0;
+    ppsz_args[i_args++] = "--no-video";
+    bool b_spool = false;
+    for (int i = 2; i < argc; i++)
+    {
+        ppsz_args[i_args++] = argv[i];
+        if (strncmp(argv[i], "--listenbrainz-spool", 20) == 0)
+            b_spool = true;
+    }
+
+    char *psz_spool = NULL;
+    if (!b_spool)
+    {
+        psz_spool = DefaultSpool();
+        if (psz_spool == NULL)
+        {
+            fprintf(stderr, "%s: no cache directory, set "
+                    "--listenbrainz-spool=DIR\n", argv[0]);
+            return 2;
+        }
+        ppsz_args[i_args++] = psz_spool;
+    }
+    ppsz_args[i_args++] = psz_serve;
+
+    /* the signals are waited for below, not delivered to the threads of VLC */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    libvlc_instance_t *p_vlc = libvlc_new(i_args, ppsz_args);
+    if (p_vlc == NULL)
+    {
+        fprintf(stderr, "%s: cannot start libVLC\n", argv[0]);
+        return 1;
+    }
+    if (libvlc_add_intf(p_vlc, "listenbrainz") != 0)
+    {
+        fprintf(stderr, "%s: cannot start the listenbrainz plugin\n", argv[0]);
+        libvlc_release(p_vlc);
+        return 1;
+    }
+
+    int i_signal;
+    sigwait(&set, &i_signal);
+
+    /* the plugin keeps what it could not submit in its spool */
+    libvlc_release(p_vlc);
+    free(psz_spool);
+    free(psz_serve);
+    free(ppsz_args);
+    return 0;
+}
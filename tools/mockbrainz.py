@@ -0,0 +1,426 @@
+#!/usr/bin/env python3
+"""Local stand-in for the ListenBrainz API, to test the plugin offline.
+
+It serves the two endpoints the plugin uses, /1/validate-token and
+/1/submit-listens, over http or https, and can misbehave on purpose to
+measure throughput and recovery:
+
+    mockbrainz.py certs DIR
+        Create a self-signed CA and a localhost certificate signed by it
+        in DIR (needs openssl). Trust DIR/ca.pem on the machine running
+        VLC to submit over https.
+
+    mockbrainz.py serve [--port 8080 | --unix PATH] [--tls DIR]
+                        [--token TOKEN]... [--fault SPEC]... [--script FILE]
+                        [--rate-limit N/SECONDS] [--max-listens N]
+        Serve until interrupted, printing the listens received per
+        second. GET /stats returns the counters as JSON.
+
+Point VLC at it with --submission-url=http://localhost:8080, or
+https://localhost:8443 with --tls. With --unix PATH, it serves a local
+socket instead, for --submission-url=unix://PATH.
+
+A fault SPEC is KIND[=VALUE][@PROBABILITY], applied to each request
+with the given probability (1 by default):
+
+    latency=SECONDS     answer late
+    429=SECONDS         Too Many Requests, with Retry-After: SECONDS
+    500, 502, 503...    answer with that server error
+    reset               reset the connection without answering
+    partial             send half of the answer, then close
+    slowloris=SECONDS   trickle the answer over SECONDS
+
+Faults combine: e.g. --fault latency=0.2 --fault 503@0.1. A script FILE
+holds one list of comma separated specs per line, for the requests in
+order ("ok" for none); once it is exhausted, the --fault specs apply.
+
+As ListenBrainz, it refuses submissions of more than --max-listens
+listens (1000) with a 400, and with --rate-limit N/SECONDS, answers 429
+past N requests in a window of SECONDS. Every answer then tells what is
+left of the window in X-RateLimit-Limit, X-RateLimit-Remaining and
+X-RateLimit-Reset-In.
+"""
+
+import argparse
+import gzip
+import json
+import math
+import os
+import random
+import socket
+import ssl
+import struct
+import subprocess
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from socketserver import ThreadingUnixStreamServer
+
+
+class Fault:
+    def __init__(self, spec):
+        kind, _, prob = spec.partition("@")
+        self.kind, _, value = kind.partition("=")
+        self.value = float(value) if value else None
+        self.prob = float(prob) if prob else 1.0
+        if self.kind.isdigit():
+            self.status = int(self.kind)
+            if self.status != 429 and not 500 <= self.status < 600:
+                raise ValueError("unsupported status %s" % self.kind)
+        elif self.kind not in ("latency", "reset", "partial", "slowloris",
+                               "ok"):
+            raise ValueError("unknown fault %s" % self.kind)
+
+    def __repr__(self):
+        return "%s=%s@%s" % (self.kind, self.value, self.prob)
+
+
+class RateLimit:
+    """Fixed windows of SECONDS allowing N requests, as ListenBrainz has"""
+
+    def __init__(self, spec):
+        limit, _, window = spec.partition("/")
+        self.limit = int(limit)
+        self.window = float(window or 10)
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        self.used = 0
+
+    def take(self):
+        """Count a request: whether it is allowed, and the headers telling
+        what is left of the window"""
+        with self.lock:
+            now = time.monotonic()
+            if now - self.start >= self.window:
+                self.start = now
+                self.used = 0
+            self.used += 1
+            reset = math.ceil(self.window - (now - self.start))
+            return self.used <= self.limit, [
+                ("X-RateLimit-Limit", "%d" % self.limit),
+                ("X-RateLimit-Remaining", "%d" % max(self.limit - self.used, 0)),
+                ("X-RateLimit-Reset-In", "%d" % reset)]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = 0
+        self.listens = 0
+        self.statuses = {}
+        self.faults = {}
+        self.last_failure = None
+        self.recoveries = []
+
+    def count(self, status, listens=0, fault=None):
+        with self.lock:
+            self.requests += 1
+            self.listens += listens
+            self.statuses[status] = self.statuses.get(status, 0) + 1
+            if fault is not None:
+                self.faults[fault] = self.faults.get(fault, 0) + 1
+            now = time.monotonic()
+            if status != 200:
+                if self.last_failure is None:
+                    self.last_failure = now
+            elif self.last_failure is not None:
+                # time from the first failure to the next success
+                self.recoveries.append(now - self.last_failure)
+                self.last_failure = None
+
+    def snapshot(self):
+        with self.lock:
+            return {
+                "requests": self.requests,
+                "listens": self.listens,
+                "listens_per_request": round(
+                    self.listens / max(self.statuses.get(200, 0), 1), 1),
+                "statuses": {str(k): v for k, v in self.statuses.items()},
+                "faults": dict(self.faults),
+                "recoveries": list(self.recoveries),
+            }
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "mockbrainz/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write("%s %s\n" % (self.address_string(), fmt % args))
+
+    def token(self):
+        auth = self.headers.get("Authorization", "")
+        if not auth.startswith("Token "):
+            return None
+        return auth[6:].strip()
+
+    def token_valid(self, token):
+        return token and (not self.server.tokens or token in self.server.tokens)
+
+    def pick_faults(self):
+        with self.server.lock:
+            if self.server.script:
+                return self.server.script.pop(0)
+        return [f for f in self.server.faults if random.random() < f.prob]
+
+    def answer(self, status, body, headers=(), faults=()):
+        payload = json.dumps(body).encode()
+        raw = ["HTTP/1.1 %d %s" % (status, self.responses[status][0]),
+               "Content-Type: application/json",
+               "Content-Length: %d" % len(payload)]
+        raw += ["%s: %s" % h for h in headers]
+        data = ("\r\n".join(raw) + "\r\n\r\n").encode() + payload
+
+        for fault in faults:
+            if fault.kind == "reset":
+                # SO_LINGER with a zero timeout turns the close into a RST
+                self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER,
+                                           struct.pack("ii", 1, 0))
+                self.close_connection = True
+                return
+            if fault.kind == "partial":
+                self.wfile.write(data[:len(data) // 2])
+                self.wfile.flush()
+                self.close_connection = True
+                return
+            if fault.kind == "slowloris":
+                step = (fault.value or 10.0) / len(data)
+                for i in range(len(data)):
+                    self.wfile.write(data[i:i + 1])
+                    self.wfile.flush()
+                    time.sleep(step)
+                return
+        self.wfile.write(data)
+
+    def handle_faults(self, faults):
+        """Apply the faults answering in place of the server, if any"""
+        for fault in faults:
+            if fault.kind == "latency":
+                time.sleep(fault.value or 1.0)
+        for fault in faults:
+            if fault.kind.isdigit():
+                headers = []
+                if fault.status == 429:
+                    headers.append(("Retry-After", "%d" % (fault.value or 1)))
+                self.server.stats.count(self.seen(fault.status, faults),
+                                        fault=self.fault_name(faults))
+                self.answer(fault.status, {"code": fault.status,
+                                           "error": "injected fault"},
+                            headers, faults)
+                return True
+        return False
+
+    def rate_limit(self, faults):
+        """Answer 429 past the rate limit, else return its headers"""
+        if self.server.rate_limit is None:
+            return False, []
+        allowed, headers = self.server.rate_limit.take()
+        if not allowed:
+            self.server.stats.count(self.seen(429, faults))
+            self.answer(429, {"code": 429, "error": "Too many requests"},
+                        headers + [("Retry-After", headers[-1][1])], faults)
+        return not allowed, headers
+
+    def do_GET(self):
+        if self.path == "/stats":
+            self.answer(200, self.server.stats.snapshot())
+            return
+        if self.path != "/1/validate-token":
+            self.answer(404, {"code": 404, "error": "Not found"})
+            return
+
+        faults = self.pick_faults()
+        if self.handle_faults(faults):
+            return
+        limited, headers = self.rate_limit(faults)
+        if limited:
+            return
+        token = self.token()
+        body = {"code": 200, "message": "Token valid.", "valid": True,
+                "user_name": "mockbrainz"}
+        if not self.token_valid(token):
+            body = {"code": 200, "message": "Token invalid.", "valid": False}
+        self.server.stats.count(self.seen(200, faults),
+                                fault=self.fault_name(faults))
+        self.answer(200, body, headers, faults)
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        data = self.rfile.read(length)
+        if self.path != "/1/submit-listens":
+            self.answer(404, {"code": 404, "error": "Not found"})
+            return
+
+        faults = self.pick_faults()
+        if self.handle_faults(faults):
+            return
+        limited, headers = self.rate_limit(faults)
+        if limited:
+            return
+        if not self.token_valid(self.token()):
+            self.server.stats.count(self.seen(401, faults))
+            self.answer(401, {"code": 401, "error": "Invalid authorization "
+                              "token."}, headers, faults)
+            return
+
+        try:
+            if self.headers.get("Content-Encoding", "") == "gzip":
+                data = gzip.decompress(data)
+            body = json.loads(data)
+            listens = body["payload"]
+            if body["listen_type"] not in ("single", "import", "playing_now"):
+                raise ValueError("bad listen_type")
+            if len(listens) > self.server.max_listens:
+                raise ValueError("Too many listens. You may not submit more "
+                                 "than %d listens at once."
+                                 % self.server.max_listens)
+            for listen in listens:
+                meta = listen["track_metadata"]
+                if not meta["artist_name"] or not meta["track_name"]:
+                    raise ValueError("missing artist or track name")
+        except (OSError, ValueError, KeyError, TypeError) as e:
+            self.server.stats.count(self.seen(400, faults))
+            self.answer(400, {"code": 400, "error": str(e)}, headers, faults)
+            return
+
+        self.server.stats.count(self.seen(200, faults), len(listens),
+                                self.fault_name(faults))
+        self.answer(200, {"status": "ok"}, headers, faults)
+
+    @staticmethod
+    def fault_name(faults):
+        return ",".join(f.kind for f in faults if f.kind != "ok") or None
+
+    @staticmethod
+    def seen(status, faults):
+        """Status the client gets, 0 for none"""
+        if any(f.kind in ("reset", "partial") for f in faults):
+            return 0
+        return status
+
+
+def make_certs(directory):
+    os.makedirs(directory, exist_ok=True)
+    ca_key, ca = (os.path.join(directory, n) for n in ("ca.key", "ca.pem"))
+    key, csr, cert = (os.path.join(directory, n)
+                      for n in ("server.key", "server.csr", "server.pem"))
+    ext = os.path.join(directory, "server.ext")
+    with open(ext, "w") as f:
+        f.write("subjectAltName=DNS:localhost,IP:127.0.0.1,IP:::1\n")
+
+    def openssl(*args):
+        subprocess.run(("openssl",) + args, check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    openssl("req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "3650",
+            "-subj", "/CN=mockbrainz CA", "-keyout", ca_key, "-out", ca)
+    openssl("req", "-newkey", "rsa:2048", "-nodes", "-subj", "/CN=localhost",
+            "-keyout", key, "-out", csr)
+    openssl("x509", "-req", "-in", csr, "-CA", ca, "-CAkey", ca_key,
+            "-CAcreateserial", "-days", "3650", "-extfile", ext, "-out", cert)
+    print("CA certificate: %s" % ca)
+
+
+def report(stats):
+    last = 0
+    while True:
+        time.sleep(1)
+        listens = stats.snapshot()["listens"]
+        if listens != last:
+            print("%d listens/s, %d in total" % (listens - last, listens),
+                  flush=True)
+            last = listens
+
+
+class UnixHTTPServer(ThreadingUnixStreamServer):
+    """The API over a local socket, as the unix:// sink submits to it"""
+
+    def get_request(self):
+        # the peers of a local socket have no address to log
+        request, _ = super().get_request()
+        return request, ("local", 0)
+
+
+def serve(args):
+    if args.unix:
+        if os.path.exists(args.unix):
+            os.unlink(args.unix)
+        server = UnixHTTPServer(args.unix, Handler)
+    else:
+        server = ThreadingHTTPServer((args.bind, args.port), Handler)
+    server.daemon_threads = True
+    server.verbose = args.verbose
+    server.tokens = set(args.token)
+    server.faults = [Fault(s) for s in args.fault]
+    server.script = []
+    server.lock = threading.Lock()
+    server.stats = Stats()
+    server.rate_limit = RateLimit(args.rate_limit) if args.rate_limit else None
+    server.max_listens = args.max_listens
+    if args.script:
+        with open(args.script) as f:
+            for line in f:
+                line = line.split("#")[0].strip()
+                if line:
+                    server.script.append([Fault(s.strip())
+                                          for s in line.split(",")])
+
+    scheme = "http"
+    if args.tls:
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(os.path.join(args.tls, "server.pem"),
+                            os.path.join(args.tls, "server.key"))
+        server.socket = ctx.wrap_socket(server.socket, server_side=True)
+        scheme = "https"
+
+    if args.unix:
+        where = "unix://%s" % args.unix
+    else:
+        where = "%s://%s:%d" % (scheme, args.bind, args.port)
+    print("Serving on %s, faults: %s" % (where, server.faults or "none"))
+    threading.Thread(target=report, args=(server.stats,), daemon=True).start()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    if args.unix:
+        os.unlink(args.unix)
+    print(json.dumps(server.stats.snapshot(), indent=2))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    certs = sub.add_parser("certs", help="create a CA and a certificate")
+    certs.add_argument("directory")
+
+    srv = sub.add_parser("serve", help="serve the API")
+    srv.add_argument("--bind", default="127.0.0.1")
+    srv.add_argument("--port", type=int, default=8080)
+    srv.add_argument("--unix", metavar="PATH",
+                     help="serve a local socket instead of a TCP port")
+    srv.add_argument("--tls", metavar="DIR",
+                     help="serve https with the certificate of DIR")
+    srv.add_argument("--token", action="append", default=[],
+                     help="accepted token, any by default")
+    srv.add_argument("--fault", action="append", default=[], metavar="SPEC")
+    srv.add_argument("--script", metavar="FILE")
+    srv.add_argument("--rate-limit", metavar="N/SECONDS",
+                     help="requests allowed per window of SECONDS")
+    srv.add_argument("--max-listens", type=int, default=1000, metavar="N",
+                     help="listens allowed per submission")
+    srv.add_argument("--verbose", action="store_true")
+
+    args = parser.parse_args()
+    if args.command == "certs":
+        make_certs(args.directory)
+    else:
+        serve(args)
+
+
+if __name__ == "__main__":
+    main()
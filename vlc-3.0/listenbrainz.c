@@ -33,14 +33,22 @@
 #ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
+#include <io.h>
 #define HAVE_POLL_H 0
+#define fsync(fd) _commit(fd)
 #else
 #define HAVE_POLL_H 1
 #include<poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #endif
 
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
 #include <time.h>
 
 #include <vlc_common.h>
@@ -52,18 +60,46 @@
 #include <vlc_memstream.h>
 #include <vlc_stream.h>
 #include <vlc_url.h>
+#include <vlc_fs.h>
+#include <vlc_configuration.h>
 #include <vlc_network.h>
 #include <vlc_tls.h>
+#include <vlc_interrupt.h>
 #include <vlc_playlist.h>
 
+#ifdef HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+# include <vlc_cpu.h>
+# include <immintrin.h>
+# define HAVE_JSON_SIMD 1
+#endif
+
 #define N_(str) (str)
 #define VLC_TICK_INVALID INT64_C(0)
 
+/* The clocks the listen rules and the backoffs follow. A build can replace
+ * them, e.g. by a simulated clock running days of playback and retries in
+ * milliseconds, by defining LISTENBRAINZ_CLOCK to a header which provides
+ * ClockNow(), ClockWait() and ClockTime(), standing for mdate(),
+ * mwait() and time(). Timings of the traces and metrics stay real. */
+#ifdef LISTENBRAINZ_CLOCK
+# include LISTENBRAINZ_CLOCK
+#else
+# define ClockNow()             mdate()
+# define ClockWait(deadline)    mwait(deadline)
+# define ClockTime(p_time)      time(p_time)
+#endif
+
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
 
+#ifndef QUEUE_MAX
 #define QUEUE_MAX 50
+#endif
 
 /* Keeps track of metadata to be submitted */
 typedef struct listenbrainz_song_t
@@ -75,44 +111,584 @@ typedef struct listenbrainz_song_t
     int         i_l;                /**< track length     */
     char        *psz_m;             /**< musicbrainz id   */
     time_t      date;               /**< date since epoch */
-    mtime_t     i_start;            /**< playing start    */
+    bool        b_cached;           /**< strings in the meta data cache */
 } listenbrainz_song_t;
 
+/* Meta data shared by queued listens, e.g. the artist and the album of an
+ * album played through: each distinct string is kept once, with its JSON
+ * form, and counts the listens referencing it */
+typedef struct listenbrainz_string_t
+{
+    struct listenbrainz_string_t *p_next;   /**< in its bucket          */
+    uint64_t    i_hash;                     /**< of psz                 */
+    unsigned    i_refs;                     /**< listens using it       */
+    size_t      i_json;                     /**< length of psz_json     */
+    char       *psz_json;                   /**< quoted and escaped,
+                                             * stored after psz        */
+    char        psz[];                      /**< URI-encoded meta data  */
+} listenbrainz_string_t;
+
+/* Intern table of those strings, chained in a power of 2 of buckets */
+typedef struct listenbrainz_strings_t
+{
+    listenbrainz_string_t **pp_buckets;     /**< NULL until first use   */
+    size_t      i_buckets;
+    size_t      i_count;                    /**< strings in the table   */
+} listenbrainz_strings_t;
+
+/* Where a listen of the queue comes from. Those of imports carry how far
+ * their source is delivered with them, which TrimQueue records. */
+enum
+{
+    LISTEN_PLAYED,
+    LISTEN_IMPORT,                              /**< file offset past it    */
+    LISTEN_SPOOL,                               /**< listens queued from it */
+    LISTEN_SOURCES
+};
+
+/* A listen waiting in the queue */
+typedef struct listenbrainz_listen_t
+{
+    time_t                  date;           /**< date since epoch       */
+    size_t                  i_size;         /**< of its JSON object     */
+    listenbrainz_string_t  *p_a;            /**< track artist           */
+    listenbrainz_string_t  *p_t;            /**< track title            */
+    listenbrainz_string_t  *p_b;            /**< track album, or NULL   */
+    listenbrainz_string_t  *p_m;            /**< musicbrainz id, or NULL*/
+    int                     i_source;       /**< LISTEN_*               */
+    int64_t                 i_offset;       /**< progress of its source
+                                             * once delivered, or 0     */
+} listenbrainz_listen_t;
+
+/* Rolling index of the listens already accepted for submission, used to drop
+ * duplicates. Each generation is an open-addressing set of fingerprints; when
+ * the current one is half full, the older one is discarded and reused, so the
+ * memory is bounded and the most recent listens are always remembered. */
+#define DEDUP_SLOTS 1024
+
+typedef struct listenbrainz_dedup_t
+{
+    uint64_t    p_slots[2][DEDUP_SLOTS]; /**< fingerprints, 0 if empty */
+    unsigned    i_current;               /**< generation receiving inserts */
+    unsigned    i_fill;                  /**< used slots in that generation */
+} listenbrainz_dedup_t;
+
+/* On-disk cache of the meta data of local files, keyed by a hash of their URI
+ * and checked against their modification time. Playing a file again then
+ * costs a lookup in a memory-mapped table instead of reading and encoding the
+ * meta data of the item, and does not wait for the preparser. The file holds
+ * a header, an open-addressing table of slots and a heap of the URI-encoded
+ * strings; it is emptied whenever either one is full. The table has a power
+ * of 2 of slots, a third more than the files of listenbrainz-meta-cache, and
+ * the heap CACHE_SLOT_HEAP bytes per slot. */
+#define CACHE_MAGIC     "LBMETA1"
+#define CACHE_SLOT_HEAP 128
+/* Upper bound of the listenbrainz-meta-cache setting */
+#define CACHE_MAX       (1 << 20)
+
+typedef struct listenbrainz_cache_header_t
+{
+    char        psz_magic[8];       /**< CACHE_MAGIC       */
+    uint32_t    i_slots;            /**< size of the table */
+    uint32_t    i_entries;          /**< used slots        */
+    uint32_t    i_heap;             /**< used heap bytes   */
+    uint32_t    i_reserved;
+} listenbrainz_cache_header_t;
+
+typedef struct listenbrainz_cache_slot_t
+{
+    uint64_t    i_key;              /**< URI hash, 0 if empty */
+    int64_t     i_mtime;            /**< file modification */
+    uint32_t    i_offset;           /**< strings in heap   */
+    uint32_t    i_size;             /**< their total size  */
+    int32_t     i_l;                /**< track length      */
+    uint32_t    i_reserved;
+} listenbrainz_cache_slot_t;
+
+typedef struct listenbrainz_cache_t
+{
+    int                         i_fd;
+    listenbrainz_cache_header_t *p_header;  /**< NULL if no cache  */
+    listenbrainz_cache_slot_t   *p_slots;
+    char                        *p_heap;
+    uint32_t                    i_slots;    /**< a power of 2      */
+    uint32_t                    i_heap;     /**< size of the heap  */
+} listenbrainz_cache_t;
+
+/* Playback events can be recorded to a file, to be replayed later on the
+ * callbacks, e.g. by bench/replay to compare the listens and the timings of
+ * two builds. The file holds a header, then the events in the order they came,
+ * each one followed by the meta data of its item, if it has one: RECORD_META
+ * NUL-terminated strings. Numbers are in the byte order of the machine. */
+#define RECORD_MAGIC    "LBREC30"
+#define RECORD_META     7           /**< URI, artist, title, album, track
+                                     * id, track number, now playing */
+
+typedef struct listenbrainz_record_header_t
+{
+    char        psz_magic[8];       /**< RECORD_MAGIC      */
+    int64_t     i_epoch;            /**< time() at start   */
+    int64_t     i_clock;            /**< ClockNow() then   */
+} listenbrainz_record_header_t;
+
+enum
+{
+    RECORD_ITEM,                    /**< current item change   */
+    RECORD_STATE,                   /**< input state change    */
+    RECORD_POSITION,                /**< input position change */
+    RECORD_ITEM_META,               /**< item meta data change */
+};
+
+/* Flags of the item of an event */
+#define RECORD_PREPARSED    0x01
+#define RECORD_NET          0x02    /**< a stream          */
+#define RECORD_VIDEO        0x04    /**< has video tracks  */
+
+typedef struct listenbrainz_record_t
+{
+    int64_t     i_date;             /**< ClockNow()        */
+    int64_t     i_time;             /**< media time        */
+    int64_t     i_length;           /**< of the item       */
+    int64_t     i_value;            /**< 0, VLC 4.0 only   */
+    float       f_rate;             /**< playback rate     */
+    uint8_t     i_event;            /**< RECORD_*          */
+    uint8_t     i_state;            /**< input state       */
+    uint8_t     i_flags;            /**< RECORD_* flags    */
+    uint8_t     i_reserved;
+    uint32_t    i_size;             /**< meta data bytes   */
+    uint32_t    i_reserved2;
+} listenbrainz_record_t;
+
+/* Import of a listen history file. It is read a line at a time, lines longer
+ * than IMPORT_LINE_MAX being skipped, and at most IMPORT_QUEUE_MAX of its
+ * listens wait in the queue, the rest of which is left to the songs played. */
+#define IMPORT_LINE_MAX     16384
+#define IMPORT_QUEUE_MAX    __MAX(QUEUE_MAX / 2, 1)
+/* ListenBrainz refuses listens from before it started, in October 2002 */
+#define IMPORT_MIN_DATE     1033430400
+/* The progress is saved at most this often, and when the import stops */
+#define IMPORT_SAVE_INTERVAL CLOCK_FREQ
+
+typedef struct listenbrainz_import_t
+{
+    FILE       *p_file;                     /**< being imported         */
+    char       *psz_checkpoint;             /**< progress file, or NULL */
+    uint64_t    i_id;                       /**< hash of its first line */
+    int64_t     i_saved;                    /**< offset checkpointed    */
+    mtime_t     i_save_date;                /**< when it was            */
+    bool        b_local;                    /**< local time timestamps  */
+    char        psz_line[IMPORT_LINE_MAX];  /**< line being parsed      */
+} listenbrainz_import_t;
+
+/* Spool directory shared by instances of the plugin, e.g. several players of
+ * one user: each writes its listens there as segment files, and the instance
+ * holding the lock of the directory submits them. Up to SPOOL_SEGMENTS of
+ * them are read in the queue at a time, and deleted once delivered. */
+#define SPOOL_LOCK          ".lock"
+#define SPOOL_SUFFIX        ".listens"
+#define SPOOL_SEGMENTS      QUEUE_MAX
+#define SPOOL_NAME_MAX      64
+/* The others wait for the lock and are read at least this often */
+#define SPOOL_POLL          CLOCK_FREQ
+
+typedef struct listenbrainz_spool_t
+{
+    listenbrainz_import_t   reader;             /**< of the segment read    */
+    int64_t                 i_queued;           /**< listens queued from the
+                                                 * spool                    */
+    int                     i_segments;         /**< segments read          */
+    struct
+    {
+        char    psz_name[SPOOL_NAME_MAX];
+        int64_t i_last;                         /**< i_queued once read     */
+    } p_segments[SPOOL_SEGMENTS];
+    char                    ppsz_scan[SPOOL_SEGMENTS][SPOOL_NAME_MAX];
+} listenbrainz_spool_t;
+
+/* Listens handed to the helper, another instance submitting for this one,
+ * are framed as: the size of the rest of the frame (32 bits), the date
+ * (64 bits), flags (8 bits), then the artist, the title, and the album and
+ * the MBID if flagged, each as its size (16 bits) and its UTF-8 bytes. A
+ * batch ends with a frame of size 0, which the helper acknowledges with the
+ * number of frames it took (32 bits) once they are spooled. All the integers
+ * are big-endian. */
+#define HELPER_ALBUM        0x01
+#define HELPER_MBID         0x02
+#define HELPER_FRAME_MAX    IMPORT_LINE_MAX
+/* Time the helper has to acknowledge a batch */
+#define HELPER_TIMEOUT      (5 * CLOCK_FREQ)
+/* A helper not reachable is tried again this often */
+#define HELPER_RETRY        CLOCK_FREQ
+/* Instances served by a helper, or players by the ingest socket, at a time */
+#define SERVE_CLIENTS       16
+/* Wait before polling the sockets again after an error */
+#define SERVE_RETRY         CLOCK_FREQ
+
+typedef struct listenbrainz_client_t
+{
+    int         i_fd;
+    bool        b_json;                     /**< a player, sending JSON
+                                             * lines, else an instance  */
+    size_t      i_len;                      /**< bytes in p_buf         */
+    uint32_t    i_frames;                   /**< taken since the last
+                                             * batch acknowledged       */
+    uint8_t     p_buf[4 + HELPER_FRAME_MAX]; /**< frames received       */
+} listenbrainz_client_t;
+
+/* What an endpoint's server said about its token */
+enum
+{
+    TOKEN_UNKNOWN,                              /**< not validated yet      */
+    TOKEN_VALID,
+    TOKEN_INVALID,                              /**< submission paused      */
+};
+
+/* Submission metrics. They are published as variables of the libvlc object,
+ * for the Lua and HTTP interfaces, and can be exported to a file. */
+enum
+{
+    METRIC_QUEUE_DEPTH,                         /**< listens queued         */
+    METRIC_QUEUE_BYTES,                         /**< their serialized size  */
+    METRIC_QUEUE_OLDEST,                        /**< listened_at of the
+                                                 * oldest one, 0 if none    */
+    METRIC_SUBMITS,                             /**< accepted submissions   */
+    METRIC_LISTENS,                             /**< listens in them        */
+    METRIC_FAILURES_NETWORK,                    /**< no response            */
+    METRIC_FAILURES_AUTH,                       /**< token rejected         */
+    METRIC_FAILURES_CLIENT,                     /**< other 4xx              */
+    METRIC_FAILURES_SERVER,                     /**< 5xx and the rest       */
+    METRIC_DROPS,                               /**< listens lost           */
+    METRIC_RETRIES,                             /**< immediate resends      */
+    METRIC_IMPORTS,                             /**< listens imported       */
+    METRIC_RATE_LIMITED,                        /**< 429 answers            */
+    METRIC_BATCH_SPLITS,                        /**< batches too large for
+                                                 * the server, halved       */
+    METRIC_SINK_HTTP_LISTENS,                   /**< listens delivered per
+                                                 * sink, and their bytes    */
+    METRIC_SINK_UNIX_LISTENS,
+    METRIC_SINK_FILE_LISTENS,
+    METRIC_SINK_HTTP_BYTES,
+    METRIC_SINK_UNIX_BYTES,
+    METRIC_SINK_FILE_BYTES,
+    METRIC_COUNT
+};
+
+enum
+{
+    LATENCY_CONNECT,
+    LATENCY_HANDSHAKE,
+    LATENCY_ROUNDTRIP,
+    LATENCY_COUNT
+};
+
+/* Upper bounds of the latency histogram buckets, in milliseconds. A last
+ * bucket counts everything slower. */
+static const unsigned pi_latency_bounds[] =
+    { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+#define LATENCY_BUCKETS (ARRAY_SIZE(pi_latency_bounds) + 1)
+
+typedef struct listenbrainz_histogram_t
+{
+    uint64_t    pi_buckets[LATENCY_BUCKETS];    /**< samples per bucket */
+    uint64_t    i_sum;                          /**< total, milliseconds */
+} listenbrainz_histogram_t;
+
+/* The rate limit of a server, as its responses tell it in their
+ * X-RateLimit-* headers, or Retry-After */
+typedef struct listenbrainz_ratelimit_t
+{
+    int             i_remaining;        /**< requests left, -1 if unknown */
+    mtime_t         reset;              /**< when the window starts over  */
+} listenbrainz_ratelimit_t;
+
+/* The transports the endpoints deliver their batches through, picked by the
+ * scheme of their URL */
+enum
+{
+    SINK_HTTP,                                  /**< the API, over TCP      */
+    SINK_UNIX,                                  /**< the API, over a local
+                                                 * socket, e.g. of a proxy  */
+    SINK_FILE,                                  /**< a JSON Lines file      */
+    SINK_COUNT
+};
+
+struct listenbrainz_endpoint_t;
+
+typedef struct listenbrainz_sink_t
+{
+    const char *psz_scheme;
+    /** serialize i_batch queued listens from i_first, p_sys->lock held */
+    int     (*pf_forge)(intf_sys_t *, uint64_t, int, struct vlc_memstream *);
+    /** deliver them: 200 once done, else the HTTP status, or -1 */
+    int     (*pf_send)(struct listenbrainz_endpoint_t *,
+                       const struct vlc_memstream *, bool, char *, size_t);
+    /** release the connection, or the file, once the queue is drained */
+    void    (*pf_close)(struct listenbrainz_endpoint_t *);
+    int     i_listens;                          /**< METRIC_ of the listens
+                                                 * delivered through it     */
+    int     i_bytes;                            /**< and of their bytes     */
+} listenbrainz_sink_t;
+
+/* A ListenBrainz-compatible server to submit listens to. Each one has its own
+ * thread, connection, backoff and position in the shared queue, so that a slow
+ * or unreachable server never holds back delivery to the others. */
+typedef struct listenbrainz_endpoint_t
+{
+    intf_thread_t          *p_intf;
+    vlc_thread_t            thread;             /**< thread to submit songs */
+    vlc_url_t               url;                /**< where to submit data   */
+    char                   *psz_token;          /**< Authentication token   */
+    vlc_tls_creds_t       *p_creds;            /**< TLS client credentials */
+    vlc_tls_t              *p_sock;             /**< kept-alive connection  */
+    bool                    b_tls;              /**< https, else plain http */
+    vlc_interrupt_t        *p_interrupt;        /**< aborts network I/O     */
+    vlc_timer_t             deadline;           /**< interrupts late
+                                                 * exchanges                */
+    bool                    b_deadline;         /**< if it was created      */
+    bool                    b_armed;            /**< if an exchange runs,
+                                                 * p_sys->lock              */
+    bool                    b_late;             /**< if it was interrupted,
+                                                 * p_sys->lock              */
+    const listenbrainz_sink_t *p_sink;          /**< transport of the batches,
+                                                 * NULL for the helper      */
+    const char             *psz_name;           /**< host or path, in logs  */
+    char                   *psz_path;           /**< of the file or of the
+                                                 * local socket, else NULL  */
+    int                     i_fd;               /**< the open file, or -1   */
+    char                   *psz_socket;         /**< of the helper to hand
+                                                 * listens to, else NULL    */
+    int                     i_token;            /**< TOKEN_* verdict, kept
+                                                 * across reconfigurations  */
+
+    uint64_t                i_next;             /**< first listen not
+                                                 * delivered, p_sys->lock   */
+    mtime_t                 next_exchange;      /**< when can we send data  */
+    unsigned int            i_interval;         /**< waiting interval (min) */
+    unsigned int            i_failures;         /**< failed exchanges in a
+                                                 * row, opens the breaker   */
+    int                     i_batch_max;        /**< listens per submission,
+                                                 * adapted AIMD-style       */
+    mtime_t                 i_rtt;              /**< smoothed roundtrip     */
+    mtime_t                 i_slo;              /**< latency target of the
+                                                 * listens, linger included */
+    listenbrainz_ratelimit_t limit;             /**< of the server          */
+#ifdef HAVE_ZLIB_H
+    bool                    b_gzip;             /**< compress large batches */
+#endif
+} listenbrainz_endpoint_t;
+
 struct intf_sys_t
 {
-    listenbrainz_song_t     p_queue[QUEUE_MAX]; /**< songs not submitted yet*/
+    listenbrainz_listen_t   p_queue[QUEUE_MAX]; /**< songs not submitted yet*/
     int                     i_songs;            /**< number of songs        */
+    uint64_t                i_queue_base;       /**< sequence number of the
+                                                 * first song in the queue  */
+    int64_t                 pi_delivered[LISTEN_SOURCES]; /**< progress
+                                                 * of the sources           */
+    listenbrainz_dedup_t    dedup;              /**< listens already queued */
+    listenbrainz_strings_t  strings;            /**< their meta data,
+                                                 * p_sys->lock              */
+    listenbrainz_cache_t    meta_cache;         /**< known local files,
+                                                 * p_sys->lock              */
 
     input_thread_t         *p_input;            /**< current input thread   */
     vlc_mutex_t             lock;               /**< p_sys mutex            */
     vlc_cond_t              wait;               /**< song to submit event   */
-    vlc_thread_t            thread;             /**< thread to submit song  */
 
-    /* submission of played songs */
-    vlc_url_t               p_submit_url;       /**< where to submit data   */
+    /* submission of played songs, replaced as a whole when settings change */
+    vlc_mutex_t             config_lock;        /**< serializes changes     */
+    listenbrainz_endpoint_t *p_endpoints;       /**< where to submit data   */
+    int                     i_endpoints;        /**< number of endpoints    */
+    char                   *psz_settings;       /**< values they were built
+                                                 * with, config_lock        */
+    vlc_timer_t             settings_timer;     /**< checks for changes     */
+    bool                    b_settings_timer;   /**< if it was created      */
+
+    /* metrics, p_sys->lock */
+    uint64_t                pi_metrics[METRIC_COUNT]; /**< counters     */
+    listenbrainz_histogram_t p_latency[LATENCY_COUNT];
+    char                   *psz_metrics_file;   /**< export, NULL if none   */
+    vlc_timer_t             metrics_timer;      /**< periodic export        */
+
+    /* tracing */
+    vlc_mutex_t             trace_lock;         /**< serializes events      */
+    FILE                   *p_trace;            /**< trace file, or NULL    */
+    bool                    b_traced;           /**< if it has events yet   */
+    FILE                   *p_record;           /**< playback events, or
+                                                 * NULL, p_sys->trace_lock  */
 
-    char                    *psz_user_token;    /**< Authentication token */
+    /* import of a listen history file */
+    char                   *psz_import;         /**< the file, NULL if none */
+    vlc_thread_t            import_thread;
+    vlc_cond_t              import_wait;        /**< queue trimmed event    */
+    bool                    b_import_stop;      /**< p_sys->lock            */
+
+    /* spool shared with the other instances */
+    char                   *psz_spool;          /**< directory, or NULL     */
+    int                     i_spool_fd;         /**< its lock file          */
+    unsigned long           i_spool_id;         /**< names our segments     */
+    unsigned                i_spooled;          /**< segments written,
+                                                 * p_sys->lock              */
+    bool                    b_leader;           /**< if we hold its lock and
+                                                 * submit, config_lock      */
+    vlc_thread_t            spool_thread;
+    bool                    b_spool_stop;       /**< p_sys->lock            */
+
+    /* listens handed over by other instances, this one being their helper,
+     * and sent by other players */
+    char                   *psz_serve;          /**< socket, or NULL        */
+    int                     i_serve_fd;
+    char                   *psz_ingest;         /**< socket, or NULL        */
+    int                     i_ingest_fd;
+    vlc_interrupt_t        *p_serve_interrupt;
+    vlc_thread_t            serve_thread;
+    bool                    b_serve_stop;       /**< p_sys->lock            */
 
     /* data about song currently playing */
     listenbrainz_song_t     p_current_song;     /**< song being played      */
 
     mtime_t                 time_pause;         /**< time when vlc paused   */
-    mtime_t                 time_total_pauses;  /**< total time in pause    */
+
+    /* played time, accumulated from the clock of the input */
+    mtime_t                 i_played;           /**< media time played      */
+    mtime_t                 i_clock_ts;         /**< last media time seen   */
+    mtime_t                 i_clock_system;     /**< when it was seen       */
+    bool                    b_clock;            /**< if they are valid      */
 
     bool                    b_submit_nowp;      /**< do we have to submit ? */
 
     bool                    b_meta_read;        /**< if we read the song's
                                                  * metadata already         */
+
+    /* meta data last seen on a stream, to find where its tracks change */
+    char                   *psz_stream_np;      /**< now playing            */
+    char                   *psz_stream_a;       /**< artist                 */
+    char                   *psz_stream_t;       /**< title                  */
+
+    int                     i_prefetch;         /**< playlist items to
+                                                 * preparse ahead           */
+    vlc_timer_t             prefetch_timer;     /**< asks for them, if
+                                                 * i_prefetch > 0           */
 };
 
 static int  Open            (vlc_object_t *);
 static void Close           (vlc_object_t *);
 static void *Run            (void *);
+static void *Import         (void *);
+static void *Spool          (void *);
+static void *Handoff        (void *);
+static void ExchangeLate    (void *);
+static void *Serve          (void *);
+static void ServeClose      (intf_sys_t *);
+static bool SpoolLock       (int);
+static int  ForgePayload    (intf_sys_t *, uint64_t, int,
+                             struct vlc_memstream *);
+static int  ForgeLines      (intf_sys_t *, uint64_t, int,
+                             struct vlc_memstream *);
+static int  SendHttp        (listenbrainz_endpoint_t *,
+                             const struct vlc_memstream *, bool, char *,
+                             size_t);
+static int  SendFile        (listenbrainz_endpoint_t *,
+                             const struct vlc_memstream *, bool, char *,
+                             size_t);
+static void CloseHttp       (listenbrainz_endpoint_t *);
+static void CloseFile       (listenbrainz_endpoint_t *);
 
 #define USERTOKEN_TEXT      N_("User token")
 #define USERTOKEN_LONGTEXT  N_("The user token of your ListenBrainz account")
 #define URL_TEXT            N_("Submission URL")
-#define URL_LONGTEXT        N_("The URL set for an alternative ListenBrainz instance")
+#define URL_LONGTEXT        N_("The URL set for an alternative ListenBrainz instance: " \
+                                "a host name, served over https, or a " \
+                                "scheme://host:port URL, e.g. of a local " \
+                                "test server. unix:///path submits over a " \
+                                "local socket, file:///path appends the " \
+                                "listens to a file.")
+#define GZIP_TEXT           N_("Compress submissions")
+#define GZIP_LONGTEXT       N_("Send large batches of listens gzip-compressed")
+#define MIRRORS_TEXT        N_("Mirrors")
+#define MIRRORS_LONGTEXT    N_("Other ListenBrainz-compatible servers to submit " \
+                               "listens to, as comma separated token@host pairs; " \
+                               "the host may be a unix:// or file:// URL too")
+#define PREFETCH_TEXT       N_("Items to prefetch")
+#define PREFETCH_LONGTEXT   N_("Number of upcoming playlist items whose meta data " \
+                               "is read in advance")
+#define METRICS_FILE_TEXT   N_("Metrics file")
+#define METRICS_FILE_LONGTEXT N_("File the submission metrics are periodically " \
+                               "written to, in the Prometheus text format")
+#define METRICS_INTERVAL_TEXT N_("Metrics export interval")
+#define METRICS_INTERVAL_LONGTEXT N_("Seconds between two writes of the metrics file")
+#define TRACE_FILE_TEXT     N_("Trace file")
+#define TRACE_FILE_LONGTEXT N_("File the timings of the submissions are written " \
+                               "to, in the Chrome trace format")
+#define RECORD_FILE_TEXT    N_("Playback record file")
+#define RECORD_FILE_LONGTEXT N_("File the playback events received are recorded " \
+                               "to, to replay them for performance testing")
+#define IMPORT_FILE_TEXT    N_("Listen history to import")
+#define IMPORT_FILE_LONGTEXT N_("Scrobble log (.scrobbler.log) or JSON Lines " \
+                               "export of ListenBrainz whose listens are " \
+                               "submitted in the background. An interrupted " \
+                               "import resumes where it stopped.")
+
+#define SPOOL_TEXT          N_("Spool directory")
+#define SPOOL_LONGTEXT      N_("Directory shared with other instances, e.g. " \
+                               "of players in other rooms: the listens of all " \
+                               "of them are written there and submitted by " \
+                               "only one")
+#define HELPER_TEXT         N_("Submission helper")
+#define HELPER_LONGTEXT     N_("Socket of a listenbrainz-helper process, " \
+                               "which submits the listens handed to it in " \
+                               "place of VLC")
+#define SERVE_TEXT          N_("Helper socket")
+#define SERVE_LONGTEXT      N_("Socket to accept the listens of other VLC " \
+                               "instances on, set by listenbrainz-helper")
+#define INGEST_TEXT         N_("Listen ingest socket")
+#define INGEST_LONGTEXT     N_("Local socket on which other players send " \
+                               "their listens, one JSON object per line in " \
+                               "the format of the ListenBrainz exports, to " \
+                               "be submitted with those of VLC")
+#define META_CACHE_TEXT     N_("Meta data cache size")
+#define META_CACHE_LONGTEXT N_("Number of local files whose meta data are " \
+                               "kept in a file of the cache directory, " \
+                               "not to read them again when they are " \
+                               "played; 0 disables the cache")
+#define SLO_TEXT            N_("Submission latency target")
+#define SLO_LONGTEXT        N_("Longest time, in seconds, a listen may wait " \
+                               "for others to be submitted with, the time " \
+                               "of the submission included; 0 submits every " \
+                               "listen at once")
+/* Payloads smaller than this are not worth compressing */
+#define GZIP_MIN_SIZE   1024
+
+/* Failed exchanges in a row after which an endpoint is only probed */
+#define BREAKER_THRESHOLD 3
+
+/* Time a server has to answer a request, connection included, and how often
+ * a late one is interrupted until the exchange gives up */
+#define EXCHANGE_TIMEOUT  (30 * CLOCK_FREQ)
+#define EXCHANGE_REPEAT   (CLOCK_FREQ / 10)
+
+/* Listens per submission: ListenBrainz takes up to 1000, and a batch cannot
+ * be larger than the queue. The batches start at BATCH_INITIAL and grow by
+ * BATCH_STEP while the server keeps up */
+#define BATCH_MAX       __MIN(1000, QUEUE_MAX)
+#define BATCH_INITIAL   __MAX(BATCH_MAX / 10, 1)
+#define BATCH_STEP      __MAX(BATCH_MAX / 20, 1)
+/* Roundtrip a batch may always take, however low the latency target */
+#define BATCH_RTT_MIN   (2 * CLOCK_FREQ)
+
+/* Requests left in the rate limit window of a server under which they are
+ * spread over the rest of the window */
+#define RATELIMIT_HEADROOM 5
+
+/* Jitter tolerated between the media and system clocks before a jump of the
+ * media time is taken for a seek rather than for playback */
+#define CLOCK_SLACK (CLOCK_FREQ / 2)
+
+/* Period at which the settings are checked for changes */
+#define SETTINGS_INTERVAL (2 * CLOCK_FREQ)
+
+/* Upper bound of the listenbrainz-prefetch setting */
+#define PREFETCH_MAX 10
 
 /* This error value is used when ListenBrainz plugin has to be unloaded. */
 #define VLC_LISTENBRAINZ_EFATAL -72
@@ -134,15 +710,124 @@ vlc_module_begin ()
     set_description( N_("Submission of played songs to ListenBrainz") )
     add_string( "listenbrainz-usertoken", "", USERTOKEN_TEXT, USERTOKEN_LONGTEXT, false )
     add_string( "submission-url", "api.listenbrainz.org", URL_TEXT, URL_LONGTEXT, false )
+    add_string( "listenbrainz-mirrors", "", MIRRORS_TEXT, MIRRORS_LONGTEXT, true )
+    add_integer_with_range( "listenbrainz-prefetch", 3, 0, PREFETCH_MAX,
+                            PREFETCH_TEXT, PREFETCH_LONGTEXT, true )
+    add_string( "listenbrainz-metrics-file", "", METRICS_FILE_TEXT,
+                METRICS_FILE_LONGTEXT, true )
+    add_integer_with_range( "listenbrainz-metrics-interval", 60, 1, 3600,
+                            METRICS_INTERVAL_TEXT, METRICS_INTERVAL_LONGTEXT, true )
+    add_string( "listenbrainz-trace-file", "", TRACE_FILE_TEXT,
+                TRACE_FILE_LONGTEXT, true )
+    add_string( "listenbrainz-record-file", "", RECORD_FILE_TEXT,
+                RECORD_FILE_LONGTEXT, true )
+    add_loadfile( "listenbrainz-import-file", "", IMPORT_FILE_TEXT,
+                  IMPORT_FILE_LONGTEXT, true )
+    add_directory( "listenbrainz-spool", "", SPOOL_TEXT, SPOOL_LONGTEXT,
+                   true )
+    add_string( "listenbrainz-helper", "", HELPER_TEXT, HELPER_LONGTEXT, true )
+    add_string( "listenbrainz-serve", "", SERVE_TEXT, SERVE_LONGTEXT, true )
+        change_volatile()
+    add_string( "listenbrainz-ingest", "", INGEST_TEXT, INGEST_LONGTEXT,
+                true )
+    add_integer_with_range( "listenbrainz-latency-slo", 10, 0, 3600,
+                            SLO_TEXT, SLO_LONGTEXT, true )
+    add_integer_with_range( "listenbrainz-meta-cache", 16384, 0, CACHE_MAX,
+                            META_CACHE_TEXT, META_CACHE_LONGTEXT, true )
+#ifdef HAVE_ZLIB_H
+    add_bool( "listenbrainz-gzip", true, GZIP_TEXT, GZIP_LONGTEXT, true )
+#endif
     set_capability( "interface", 0 )
     set_callbacks( Open, Close )
 vlc_module_end ()
 
+/* Variables the metrics are published as, and their names in the exported
+ * file, which follows the Prometheus text format */
+static const struct
+{
+    const char *psz_var;
+    const char *psz_name;
+    const char *psz_type;
+} p_metrics[METRIC_COUNT] =
+{
+    [METRIC_QUEUE_DEPTH] = { "listenbrainz-queue-depth",
+        "listenbrainz_queue_listens", "gauge" },
+    [METRIC_QUEUE_BYTES] = { "listenbrainz-queue-bytes",
+        "listenbrainz_queue_bytes", "gauge" },
+    [METRIC_QUEUE_OLDEST] = { "listenbrainz-queue-oldest",
+        "listenbrainz_queue_oldest_timestamp_seconds", "gauge" },
+    [METRIC_SUBMITS] = { "listenbrainz-submits",
+        "listenbrainz_submits_total", "counter" },
+    [METRIC_LISTENS] = { "listenbrainz-listens-submitted",
+        "listenbrainz_listens_submitted_total", "counter" },
+    [METRIC_FAILURES_NETWORK] = { "listenbrainz-failures-network",
+        "listenbrainz_failures_total{class=\"network\"}", "counter" },
+    [METRIC_FAILURES_AUTH] = { "listenbrainz-failures-auth",
+        "listenbrainz_failures_total{class=\"auth\"}", "counter" },
+    [METRIC_FAILURES_CLIENT] = { "listenbrainz-failures-client",
+        "listenbrainz_failures_total{class=\"client\"}", "counter" },
+    [METRIC_FAILURES_SERVER] = { "listenbrainz-failures-server",
+        "listenbrainz_failures_total{class=\"server\"}", "counter" },
+    [METRIC_DROPS] = { "listenbrainz-drops",
+        "listenbrainz_drops_total", "counter" },
+    [METRIC_RETRIES] = { "listenbrainz-retries",
+        "listenbrainz_retries_total", "counter" },
+    [METRIC_IMPORTS] = { "listenbrainz-imports",
+        "listenbrainz_imports_total", "counter" },
+    [METRIC_RATE_LIMITED] = { "listenbrainz-rate-limited",
+        "listenbrainz_rate_limited_total", "counter" },
+    [METRIC_BATCH_SPLITS] = { "listenbrainz-batch-splits",
+        "listenbrainz_batch_splits_total", "counter" },
+    [METRIC_SINK_HTTP_LISTENS] = { "listenbrainz-sink-http-listens",
+        "listenbrainz_sink_listens_total{sink=\"http\"}", "counter" },
+    [METRIC_SINK_UNIX_LISTENS] = { "listenbrainz-sink-unix-listens",
+        "listenbrainz_sink_listens_total{sink=\"unix\"}", "counter" },
+    [METRIC_SINK_FILE_LISTENS] = { "listenbrainz-sink-file-listens",
+        "listenbrainz_sink_listens_total{sink=\"file\"}", "counter" },
+    [METRIC_SINK_HTTP_BYTES] = { "listenbrainz-sink-http-bytes",
+        "listenbrainz_sink_bytes_total{sink=\"http\"}", "counter" },
+    [METRIC_SINK_UNIX_BYTES] = { "listenbrainz-sink-unix-bytes",
+        "listenbrainz_sink_bytes_total{sink=\"unix\"}", "counter" },
+    [METRIC_SINK_FILE_BYTES] = { "listenbrainz-sink-file-bytes",
+        "listenbrainz_sink_bytes_total{sink=\"file\"}", "counter" },
+};
+
+static const struct
+{
+    const char *psz_var;
+    const char *psz_phase;
+} p_latencies[LATENCY_COUNT] =
+{
+    [LATENCY_CONNECT]   = { "listenbrainz-latency-connect", "connect" },
+    [LATENCY_HANDSHAKE] = { "listenbrainz-latency-handshake", "handshake" },
+    [LATENCY_ROUNDTRIP] = { "listenbrainz-latency-roundtrip", "roundtrip" },
+};
+
+/* file:// appends the listens to a file, in the format of the exports of
+ * ListenBrainz, to be imported later, e.g. on air-gapped sites */
+static const listenbrainz_sink_t p_sinks[SINK_COUNT] =
+{
+    [SINK_HTTP] = { "http", ForgePayload, SendHttp, CloseHttp,
+                    METRIC_SINK_HTTP_LISTENS, METRIC_SINK_HTTP_BYTES },
+    [SINK_UNIX] = { "unix", ForgePayload, SendHttp, CloseHttp,
+                    METRIC_SINK_UNIX_LISTENS, METRIC_SINK_UNIX_BYTES },
+    [SINK_FILE] = { "file", ForgeLines, SendFile, CloseFile,
+                    METRIC_SINK_FILE_LISTENS, METRIC_SINK_FILE_BYTES },
+};
+
 /*****************************************************************************
  * DeleteSong : Delete the char pointers in a song
  *****************************************************************************/
 static void DeleteSong(listenbrainz_song_t* p_song)
 {
+    /* the strings read from the meta data cache belong to its heap */
+    if (p_song->b_cached)
+    {
+        p_song->psz_a = p_song->psz_b = p_song->psz_t = NULL;
+        p_song->psz_m = p_song->psz_n = NULL;
+        p_song->b_cached = false;
+        return;
+    }
     FREENULL(p_song->psz_a);
     FREENULL(p_song->psz_b);
     FREENULL(p_song->psz_t);
@@ -150,518 +835,4512 @@ static void DeleteSong(listenbrainz_song_t* p_song)
     FREENULL(p_song->psz_n);
 }
 
+/* Offset basis of the 64-bit FNV-1a hash, which Fnv1a continues */
+#define FNV1A_INIT      UINT64_C(0xcbf29ce484222325)
+
 /*****************************************************************************
- * ReadMetaData : Read meta data when parsed by vlc
+ * Fnv1a : continue a 64-bit FNV-1a hash with i_size bytes
  *****************************************************************************/
-static void ReadMetaData(intf_thread_t *p_this, input_thread_t *p_input)
+static uint64_t Fnv1a(uint64_t i_hash, const void *p_data, size_t i_size)
 {
-    intf_sys_t *p_sys = p_this->p_sys;
+    const unsigned char *p = p_data;
 
-    assert(p_input != NULL);
+    for (size_t i = 0; i < i_size; i++)
+    {
+        i_hash ^= p[i];
+        i_hash *= UINT64_C(0x100000001b3);
+    }
+    return i_hash;
+}
 
-    input_item_t *p_item = input_GetItem(p_input);
-    if (p_item == NULL)
-        return;
+/*****************************************************************************
+ * HashListen : fingerprint a listen by (listened_at, artist, title)
+ *****************************************************************************/
+static uint64_t HashListen(const listenbrainz_song_t *p_song)
+{
+    uint64_t i_date = (uint64_t) p_song->date;
+    uint8_t  p_date[8];
 
-#define ALLOC_ITEM_META(a, b) do { \
-        char *psz_meta = input_item_Get##b(p_item); \
-        if (psz_meta && *psz_meta) \
-            a = vlc_uri_encode(psz_meta); \
-        free(psz_meta); \
-    } while (0)
+    /* the same fingerprint whatever the byte order of the machine */
+    for (unsigned i = 0; i < sizeof(p_date); i++)
+        p_date[i] = i_date >> (8 * i);
 
-    vlc_mutex_lock(&p_sys->lock);
+    uint64_t i_hash = Fnv1a(FNV1A_INIT, p_date, sizeof(p_date));
+    i_hash = Fnv1a(i_hash, p_song->psz_a, strlen(p_song->psz_a));
+    /* separator, so that ("ab", "c") and ("a", "bc") differ */
+    i_hash = Fnv1a(i_hash, "\xff", 1);
+    i_hash = Fnv1a(i_hash, p_song->psz_t, strlen(p_song->psz_t));
 
-    p_sys->b_meta_read = true;
+    /* 0 marks an empty slot */
+    return i_hash ? i_hash : 1;
+}
 
-    ALLOC_ITEM_META(p_sys->p_current_song.psz_a, Artist);
-    if (!p_sys->p_current_song.psz_a)
-    {
-        msg_Dbg(p_this, "No artist..");
-        DeleteSong(&p_sys->p_current_song);
-        goto end;
-    }
+static bool DedupContains(const uint64_t *p_slots, uint64_t i_hash)
+{
+    for (unsigned i = i_hash & (DEDUP_SLOTS - 1); p_slots[i] != 0;
+         i = (i + 1) & (DEDUP_SLOTS - 1))
+        if (p_slots[i] == i_hash)
+            return true;
+    return false;
+}
 
-    ALLOC_ITEM_META(p_sys->p_current_song.psz_t, Title);
-    if (!p_sys->p_current_song.psz_t)
+/*****************************************************************************
+ * DedupInsert : record a listen, false if it was already known
+ *****************************************************************************/
+static bool DedupInsert(listenbrainz_dedup_t *p_dedup, uint64_t i_hash)
+{
+    if (DedupContains(p_dedup->p_slots[0], i_hash)
+     || DedupContains(p_dedup->p_slots[1], i_hash))
+        return false;
+
+    if (p_dedup->i_fill >= DEDUP_SLOTS / 2)
     {
-        msg_Dbg(p_this, "No track name..");
-        DeleteSong(&p_sys->p_current_song);
-        goto end;
+        /* forget the oldest generation */
+        p_dedup->i_current ^= 1;
+        memset(p_dedup->p_slots[p_dedup->i_current], 0,
+               sizeof(p_dedup->p_slots[0]));
+        p_dedup->i_fill = 0;
     }
 
-    /* Now we have read the mandatory meta data, so we can submit that info */
-    p_sys->b_submit_nowp = true;
-
-    ALLOC_ITEM_META(p_sys->p_current_song.psz_b, Album);
-    ALLOC_ITEM_META(p_sys->p_current_song.psz_m, TrackID);
-    ALLOC_ITEM_META(p_sys->p_current_song.psz_n, TrackNum);
-
-    p_sys->p_current_song.i_l = input_item_GetDuration(p_item) / 1000000;
-
-#undef ALLOC_ITEM_META
+    uint64_t *p_slots = p_dedup->p_slots[p_dedup->i_current];
+    unsigned i = i_hash & (DEDUP_SLOTS - 1);
+    while (p_slots[i] != 0)
+        i = (i + 1) & (DEDUP_SLOTS - 1);
+    p_slots[i] = i_hash;
+    p_dedup->i_fill++;
+    return true;
+}
 
-    msg_Dbg(p_this, "Meta data registered");
+/*****************************************************************************
+ * DedupRemove : forget a listen recorded, which was not queued after all
+ *****************************************************************************/
+static void DedupRemove(listenbrainz_dedup_t *p_dedup, uint64_t i_hash)
+{
+    for (unsigned g = 0; g < 2; g++)
+    {
+        uint64_t *p_slots = p_dedup->p_slots[g];
+        unsigned i = i_hash & (DEDUP_SLOTS - 1);
 
-    vlc_cond_signal(&p_sys->wait);
+        while (p_slots[i] != 0 && p_slots[i] != i_hash)
+            i = (i + 1) & (DEDUP_SLOTS - 1);
+        if (p_slots[i] == 0)
+            continue;
 
-    end:
-    vlc_mutex_unlock(&p_sys->lock);
+        /* the fingerprints probed past the slot move back into it, not to be
+         * cut off from their first slot */
+        for (unsigned j = (i + 1) & (DEDUP_SLOTS - 1); p_slots[j] != 0;
+             j = (j + 1) & (DEDUP_SLOTS - 1))
+        {
+            unsigned k = p_slots[j] & (DEDUP_SLOTS - 1);
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+                continue;
+            p_slots[i] = p_slots[j];
+            i = j;
+        }
+        p_slots[i] = 0;
+        if (g == p_dedup->i_current)
+            p_dedup->i_fill--;
+        return;
+    }
 }
 
 /*****************************************************************************
- * AddToQueue: Add the played song to the queue to be submitted
+ * MetaCacheOpen : map the meta data cache file, creating it if needed
  *****************************************************************************/
-static void AddToQueue (intf_thread_t *p_this)
+static void MetaCacheOpen(intf_thread_t *p_intf, listenbrainz_cache_t *p_cache)
 {
-    mtime_t                     played_time;
-    intf_sys_t                  *p_sys = p_this->p_sys;
-
-    vlc_mutex_lock(&p_sys->lock);
+    p_cache->p_header = NULL;
+#ifndef _WIN32
+    int64_t i_files = var_InheritInteger(p_intf, "listenbrainz-meta-cache");
+    if (i_files <= 0)
+        return;
 
-    /* Check that we have the mandatory meta data */
-    if (!p_sys->p_current_song.psz_t || !p_sys->p_current_song.psz_a)
-        goto end;
+    p_cache->i_slots = 64;
+    while (p_cache->i_slots < __MIN(i_files, CACHE_MAX) / 3 * 4)
+        p_cache->i_slots *= 2;
+    p_cache->i_heap = p_cache->i_slots * CACHE_SLOT_HEAP;
 
-    /* wait for the user to listen enough before submitting */
-    played_time = mdate() - p_sys->p_current_song.i_start -
-                  p_sys->time_total_pauses;
-    played_time /= 1000000; 
+    const size_t i_size = sizeof(listenbrainz_cache_header_t)
+                        + p_cache->i_slots * sizeof(listenbrainz_cache_slot_t)
+                        + p_cache->i_heap;
+    listenbrainz_cache_header_t header;
+    struct stat st;
+    char *psz_file;
 
-    /*HACK: it seam that the preparsing sometime fail,
-            so use the playing time as the song length */
-    if (p_sys->p_current_song.i_l == 0)
-        p_sys->p_current_song.i_l = played_time;
+    char *psz_dir = config_GetUserDir(VLC_CACHE_DIR);
+    if (psz_dir == NULL)
+        return;
+    vlc_mkdir(psz_dir, 0700);
+    if (asprintf(&psz_file, "%s" DIR_SEP "listenbrainz-meta.cache", psz_dir) == -1)
+        psz_file = NULL;
+    free(psz_dir);
+    if (psz_file == NULL)
+        return;
 
-    /* Don't send song shorter than 30s */
-    if (p_sys->p_current_song.i_l < 30)
+    p_cache->i_fd = vlc_open(psz_file, O_RDWR | O_CREAT, 0600);
+    if (p_cache->i_fd == -1)
     {
-        msg_Dbg(p_this, "Song too short (< 30s), not submitting");
-        goto end;
+        msg_Warn(p_intf, "cannot open %s: %s", psz_file, vlc_strerror_c(errno));
+        free(psz_file);
+        return;
     }
 
-    /* Send if the user had listen more than 240s OR half the track length */
-    if ((played_time < 240) &&
-        (played_time < (p_sys->p_current_song.i_l / 2)))
+    /* the cache is only an optimization: another instance may keep it */
+    if (flock(p_cache->i_fd, LOCK_EX | LOCK_NB))
     {
-        msg_Dbg(p_this, "Song not listened long enough, not submitting");
-        goto end;
+        msg_Dbg(p_intf, "%s is in use, not caching meta data", psz_file);
+        goto error;
     }
 
-    /* Check that all meta are present */
-    if (!p_sys->p_current_song.psz_a || !*p_sys->p_current_song.psz_a ||
-        !p_sys->p_current_song.psz_t || !*p_sys->p_current_song.psz_t)
+    if (fstat(p_cache->i_fd, &st)
+     || (size_t) st.st_size != i_size
+     || pread(p_cache->i_fd, &header, sizeof(header), 0) != sizeof(header)
+     || memcmp(header.psz_magic, CACHE_MAGIC, sizeof(header.psz_magic))
+     || header.i_slots != p_cache->i_slots
+     || header.i_entries > p_cache->i_slots || header.i_heap > p_cache->i_heap)
     {
-        msg_Dbg(p_this, "Missing artist or title, not submitting");
-        goto end;
+        /* new or incompatible file, start from an empty (sparse) one */
+        msg_Dbg(p_intf, "creating meta data cache %s", psz_file);
+        if (ftruncate(p_cache->i_fd, 0) || ftruncate(p_cache->i_fd, i_size))
+            goto error;
+        memcpy(header.psz_magic, CACHE_MAGIC, sizeof(header.psz_magic));
+        header.i_slots = p_cache->i_slots;
+        header.i_entries = 0;
+        header.i_heap = 0;
+        header.i_reserved = 0;
+        if (pwrite(p_cache->i_fd, &header, sizeof(header), 0) != sizeof(header))
+            goto error;
     }
 
-    if (p_sys->i_songs >= QUEUE_MAX)
+    void *p_map = mmap(NULL, i_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       p_cache->i_fd, 0);
+    if (p_map == MAP_FAILED)
+        goto error;
+
+    p_cache->p_header = p_map;
+    p_cache->p_slots = (listenbrainz_cache_slot_t *) (p_cache->p_header + 1);
+    p_cache->p_heap = (char *) (p_cache->p_slots + p_cache->i_slots);
+    msg_Dbg(p_intf, "%"PRIu32" cached meta data in %s",
+            p_cache->p_header->i_entries, psz_file);
+    free(psz_file);
+    return;
+
+    error:
+    msg_Warn(p_intf, "cannot use %s, not caching meta data", psz_file);
+    vlc_close(p_cache->i_fd);
+    free(psz_file);
+#else
+    VLC_UNUSED(p_intf);
+#endif
+}
+
+static void MetaCacheClose(listenbrainz_cache_t *p_cache)
+{
+#ifndef _WIN32
+    if (p_cache->p_header == NULL)
+        return;
+
+    munmap(p_cache->p_header, sizeof(listenbrainz_cache_header_t)
+                        + p_cache->i_slots * sizeof(listenbrainz_cache_slot_t)
+                        + p_cache->i_heap);
+    vlc_close(p_cache->i_fd);
+#else
+    VLC_UNUSED(p_cache);
+#endif
+}
+
+/*****************************************************************************
+ * MetaCacheKey : identify a local file by its URI and modification time. It
+ * reads the URI in place: finding the meta data in the cache allocates
+ * nothing.
+ *****************************************************************************/
+static bool MetaCacheKey(input_item_t *p_item, uint64_t *pi_key,
+                         int64_t *pi_mtime)
+{
+    char        psz_path[PATH_MAX];
+    struct stat st;
+    bool        b_ret = false;
+
+    /* streams have no modification time, their meta data are never cached */
+    vlc_mutex_lock(&p_item->lock);
+    const char *psz_uri = p_item->psz_uri;
+    if (psz_uri != NULL && !strncmp(psz_uri, "file:///", 8)
+     && strlen(psz_uri + 7) < sizeof(psz_path))
     {
-        msg_Warn(p_this, "Submission queue is full, not submitting");
-        goto end;
+        strcpy(psz_path, psz_uri + 7);
+
+        uint64_t i_hash = Fnv1a(FNV1A_INIT, psz_uri, strlen(psz_uri));
+        /* 0 marks an empty slot */
+        *pi_key = i_hash ? i_hash : 1;
+        b_ret = true;
     }
+    vlc_mutex_unlock(&p_item->lock);
 
-    msg_Dbg(p_this, "Song will be submitted.");
+    if (!b_ret || vlc_uri_decode(psz_path) == NULL
+     || vlc_stat(psz_path, &st) != 0)
+        return false;
+    *pi_mtime = st.st_mtime;
+    return true;
+}
+
+/* Slot holding the key, or the empty one where it would go */
+static listenbrainz_cache_slot_t *MetaCacheFind(const listenbrainz_cache_t *p_cache,
+                                                uint64_t i_key)
+{
+    uint32_t i_slot = i_key & (p_cache->i_slots - 1);
+
+    for (unsigned i = 0; i < p_cache->i_slots; i++)
+    {
+        listenbrainz_cache_slot_t *p_slot = &p_cache->p_slots[i_slot];
+        if (p_slot->i_key == i_key || p_slot->i_key == 0)
+            return p_slot;
+        i_slot = (i_slot + 1) & (p_cache->i_slots - 1);
+    }
+    return NULL;
+}
 
-#define QUEUE_COPY(a) \
-    p_sys->p_queue[p_sys->i_songs].a = p_sys->p_current_song.a
+/*****************************************************************************
+ * MetaCacheRead : fill a song from the cache, if it knows the file as it is.
+ * The strings of the song are then views of the heap, valid until the next
+ * MetaCacheWrite: only the current song is read from the cache, and it is
+ * the one written to it.
+ *****************************************************************************/
+static bool MetaCacheRead(const listenbrainz_cache_t *p_cache, uint64_t i_key,
+                          int64_t i_mtime, listenbrainz_song_t *p_song)
+{
+    char *ppsz_meta[5];
 
-#define QUEUE_COPY_NULL(a) \
-    QUEUE_COPY(a); \
-    p_sys->p_current_song.a = NULL
+    if (p_cache->p_header == NULL)
+        return false;
 
-    QUEUE_COPY(i_l);
-    QUEUE_COPY_NULL(psz_n);
-    QUEUE_COPY_NULL(psz_a);
-    QUEUE_COPY_NULL(psz_t);
-    QUEUE_COPY_NULL(psz_b);
-    QUEUE_COPY_NULL(psz_m);
-    QUEUE_COPY(date);
-#undef QUEUE_COPY_NULL
-#undef QUEUE_COPY
+    const listenbrainz_cache_slot_t *p_slot = MetaCacheFind(p_cache, i_key);
+    if (p_slot == NULL || p_slot->i_key != i_key || p_slot->i_mtime != i_mtime)
+        return false;
 
-    p_sys->i_songs++;
+    /* the file may have been damaged, never read outside of the heap */
+    uint32_t i_heap = p_cache->p_header->i_heap;
+    if (i_heap > p_cache->i_heap || p_slot->i_offset > i_heap
+     || p_slot->i_size > i_heap - p_slot->i_offset)
+        return false;
 
-    /* signal the main loop we have something to submit */
-    vlc_cond_signal(&p_sys->wait);
+    char *p = &p_cache->p_heap[p_slot->i_offset];
+    const char *p_end = p + p_slot->i_size;
+    for (int i = 0; i < 5; i++)
+    {
+        char *p_nul = memchr(p, '\0', p_end - p);
+        if (p_nul == NULL)
+            return false;
+        ppsz_meta[i] = p;
+        p = p_nul + 1;
+    }
+    if (!*ppsz_meta[0] || !*ppsz_meta[1])
+        return false;
 
-    end:
-    DeleteSong(&p_sys->p_current_song);
-    vlc_mutex_unlock(&p_sys->lock);
+    DeleteSong(p_song);
+    p_song->psz_a = ppsz_meta[0];
+    p_song->psz_t = ppsz_meta[1];
+    p_song->psz_b = *ppsz_meta[2] ? ppsz_meta[2] : NULL;
+    p_song->psz_m = *ppsz_meta[3] ? ppsz_meta[3] : NULL;
+    p_song->psz_n = *ppsz_meta[4] ? ppsz_meta[4] : NULL;
+    p_song->i_l = p_slot->i_l;
+    p_song->b_cached = true;
+    return true;
 }
 
 /*****************************************************************************
- * PlayingChange: Playing status change callback
+ * MetaCacheWrite : remember the meta data of a file
  *****************************************************************************/
-static int PlayingChange(vlc_object_t *p_this, const char *psz_var,
-                         vlc_value_t oldval, vlc_value_t newval, void *p_data)
+static void MetaCacheWrite(listenbrainz_cache_t *p_cache, uint64_t i_key,
+                           int64_t i_mtime, const listenbrainz_song_t *p_song)
 {
-    VLC_UNUSED(oldval);
+    const char *ppsz_meta[] = { p_song->psz_a, p_song->psz_t, p_song->psz_b,
+                                p_song->psz_m, p_song->psz_n };
+    size_t pi_len[ARRAY_SIZE(ppsz_meta)];
+    size_t i_size = 0;
 
-    intf_thread_t   *p_intf = (intf_thread_t*) p_data;
-    intf_sys_t      *p_sys  = p_intf->p_sys;
-    input_thread_t  *p_input = (input_thread_t*)p_this;
-    int             state;
+    if (p_cache->p_header == NULL)
+        return;
 
-    VLC_UNUSED(psz_var);
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_meta); i++)
+    {
+        pi_len[i] = ppsz_meta[i] ? strlen(ppsz_meta[i]) : 0;
+        i_size += pi_len[i] + 1;
+    }
+    if (i_size > p_cache->i_heap)
+        return;
 
-    if (newval.i_int != INPUT_EVENT_STATE) return VLC_SUCCESS;
+    listenbrainz_cache_header_t *p_header = p_cache->p_header;
+    listenbrainz_cache_slot_t *p_slot = MetaCacheFind(p_cache, i_key);
 
-    if (var_CountChoices(p_input, "video-es"))
+    /* entries replaced after a file change leave garbage in the heap, which
+     * is reclaimed along with everything else when the cache is full */
+    if (p_slot == NULL
+     || (p_slot->i_key == 0
+      && p_header->i_entries >= p_cache->i_slots / 4 * 3)
+     || i_size > p_cache->i_heap - p_header->i_heap)
     {
-        msg_Dbg(p_this, "Not an audio-only input, not submitting");
-        return VLC_SUCCESS;
+        memset(p_cache->p_slots, 0,
+               p_cache->i_slots * sizeof(listenbrainz_cache_slot_t));
+        p_header->i_entries = 0;
+        p_header->i_heap = 0;
+        p_slot = MetaCacheFind(p_cache, i_key);
     }
 
-    state = var_GetInteger(p_input, "state");
-
-    if (!p_sys->b_meta_read && state >= PLAYING_S)
+    char *p = &p_cache->p_heap[p_header->i_heap];
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_meta); i++)
     {
-        ReadMetaData(p_intf, p_input);
-        return VLC_SUCCESS;
+        memcpy(p, ppsz_meta[i] ? ppsz_meta[i] : "", pi_len[i] + 1);
+        p += pi_len[i] + 1;
+    }
+
+    if (p_slot->i_key == 0)
+        p_header->i_entries++;
+    p_slot->i_key = i_key;
+    p_slot->i_mtime = i_mtime;
+    p_slot->i_offset = p_header->i_heap;
+    p_slot->i_size = i_size;
+    p_slot->i_l = p_song->i_l;
+    p_header->i_heap += i_size;
+}
+
+/*****************************************************************************
+ * JSON strings: meta data is escaped for JSON and validated as UTF-8, invalid
+ * sequences being replaced by U+FFFD. JsonSpan finds the runs to copy as they
+ * are, the bulk of the meta data; it goes over ASCII 16 or 32 bytes at a time
+ * with SSE2 or AVX2 where the CPU has them, as chosen by JsonSelect().
+ *****************************************************************************/
+
+/* Length of the valid UTF-8 sequence psz starts with, 0 if invalid */
+static size_t Utf8Sequence(const char *psz, size_t i_len)
+{
+    const unsigned char *p = (const unsigned char *) psz;
+    size_t i_seq;
+    uint32_t i_cp;
+
+    if (p[0] < 0x80)
+        return 1;
+    if (p[0] >= 0xC2 && p[0] <= 0xDF)
+        i_seq = 2, i_cp = p[0] & 0x1F;
+    else if (p[0] >= 0xE0 && p[0] <= 0xEF)
+        i_seq = 3, i_cp = p[0] & 0x0F;
+    else if (p[0] >= 0xF0 && p[0] <= 0xF4)
+        i_seq = 4, i_cp = p[0] & 0x07;
+    else
+        return 0;
+
+    if (i_len < i_seq)
+        return 0;
+    for (size_t i = 1; i < i_seq; i++)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+        i_cp = (i_cp << 6) | (p[i] & 0x3F);
+    }
+
+    /* overlong forms, surrogates and beyond U+10FFFF */
+    if ((i_seq == 3 && i_cp < 0x800) || (i_seq == 4 && i_cp < 0x10000)
+     || (i_cp >= 0xD800 && i_cp <= 0xDFFF) || i_cp > 0x10FFFF)
+        return 0;
+    return i_seq;
+}
+
+/* Length of the leading run of valid UTF-8 without characters to escape */
+static size_t JsonSpanC(const char *psz, size_t i_len)
+{
+    size_t i = 0;
+
+    while (i < i_len)
+    {
+        unsigned char c = psz[i];
+        if (c >= 0x80)
+        {
+            size_t i_seq = Utf8Sequence(psz + i, i_len - i);
+            if (i_seq == 0)
+                break;
+            i += i_seq;
+        }
+        else if (c < 0x20 || c == '"' || c == '\\')
+            break;
+        else
+            i++;
+    }
+    return i;
+}
+
+#ifdef HAVE_JSON_SIMD
+/* Skip the non-ASCII run starting at psz[*pi], 0 if it is not valid UTF-8 */
+static bool JsonSkipUtf8(const char *psz, size_t i_len, size_t *pi)
+{
+    do
+    {
+        size_t i_seq = Utf8Sequence(psz + *pi, i_len - *pi);
+        if (i_seq == 0)
+            return false;
+        *pi += i_seq;
+    }
+    while (*pi < i_len && (unsigned char) psz[*pi] >= 0x80);
+    return true;
+}
+
+/* Blocks of ASCII with nothing to escape are skipped whole. As signed chars,
+ * the bytes from 0x80 on are negative, i.e. below 0x20 as well. */
+__attribute__((target("sse2")))
+static size_t JsonSpanSSE2(const char *psz, size_t i_len)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    while (i + 16 <= i_len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(psz + i));
+        unsigned i_high = _mm_movemask_epi8(v);
+        unsigned i_esc = _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                _mm_cmplt_epi8(v, space))) & ~i_high;
+        if ((i_high | i_esc) == 0)
+        {
+            i += 16;
+            continue;
+        }
+
+        unsigned i_first = __builtin_ctz(i_high | i_esc);
+        i += i_first;
+        if ((i_esc >> i_first) & 1 || !JsonSkipUtf8(psz, i_len, &i))
+            return i;
+    }
+    return i + JsonSpanC(psz + i, i_len - i);
+}
+
+/* The tail is left to the scalar code: going through legacy SSE code with the
+ * upper halves of the AVX registers in use costs more than it saves */
+__attribute__((target("avx2")))
+static size_t JsonSpanAVX2(const char *psz, size_t i_len)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    while (i + 32 <= i_len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(psz + i));
+        unsigned i_high = _mm256_movemask_epi8(v);
+        unsigned i_esc = _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                _mm256_cmpeq_epi8(v, backslash)),
+                _mm256_cmpgt_epi8(space, v))) & ~i_high;
+        if ((i_high | i_esc) == 0)
+        {
+            i += 32;
+            continue;
+        }
+
+        unsigned i_first = __builtin_ctz(i_high | i_esc);
+        i += i_first;
+        if ((i_esc >> i_first) & 1 || !JsonSkipUtf8(psz, i_len, &i))
+            return i;
+    }
+    return i + JsonSpanC(psz + i, i_len - i);
+}
+#endif
+
+static size_t (*JsonSpan)(const char *, size_t) = JsonSpanC;
+
+static void JsonSelect(void)
+{
+#ifdef HAVE_JSON_SIMD
+    if (vlc_CPU_AVX2())
+        JsonSpan = JsonSpanAVX2;
+    else if (vlc_CPU_SSE2())
+        JsonSpan = JsonSpanSSE2;
+#endif
+}
+
+/*****************************************************************************
+ * PutJsonString : write a string as a quoted, escaped and valid JSON string
+ *****************************************************************************/
+static void PutJsonString(struct vlc_memstream *p_json, const char *psz)
+{
+    size_t i_len = strlen(psz);
+
+    vlc_memstream_putc(p_json, '"');
+    for (;;)
+    {
+        size_t i_span = JsonSpan(psz, i_len);
+        vlc_memstream_write(p_json, psz, i_span);
+        psz += i_span;
+        i_len -= i_span;
+        if (i_len == 0)
+            break;
+
+        /* the run ends on a character to escape or on invalid UTF-8 */
+        unsigned char c = *psz;
+        if (c >= 0x80)
+            vlc_memstream_puts(p_json, "\xEF\xBF\xBD");
+        else if (c == '"' || c == '\\')
+        {
+            vlc_memstream_putc(p_json, '\\');
+            vlc_memstream_putc(p_json, c);
+        }
+        else if (c == '\n')
+            vlc_memstream_puts(p_json, "\\n");
+        else if (c == '\r')
+            vlc_memstream_puts(p_json, "\\r");
+        else if (c == '\t')
+            vlc_memstream_puts(p_json, "\\t");
+        else
+            vlc_memstream_printf(p_json, "\\u%04x", c);
+        psz++;
+        i_len--;
+    }
+    vlc_memstream_putc(p_json, '"');
+}
+
+/*****************************************************************************
+ * StringIntern : reference the interned copy of a URI-encoded meta data
+ * string, creating it with its JSON form if it is new, p_sys->lock held
+ *****************************************************************************/
+static int StringsGrow(listenbrainz_strings_t *p_strings)
+{
+    size_t i_buckets = p_strings->i_buckets ? 2 * p_strings->i_buckets : 64;
+    listenbrainz_string_t **pp_buckets = calloc(i_buckets, sizeof(*pp_buckets));
+
+    if (pp_buckets == NULL)
+        return VLC_ENOMEM;
+
+    for (size_t i = 0; i < p_strings->i_buckets; i++)
+        for (listenbrainz_string_t *p = p_strings->pp_buckets[i], *p_next;
+             p != NULL; p = p_next)
+        {
+            p_next = p->p_next;
+            p->p_next = pp_buckets[p->i_hash & (i_buckets - 1)];
+            pp_buckets[p->i_hash & (i_buckets - 1)] = p;
+        }
+
+    free(p_strings->pp_buckets);
+    p_strings->pp_buckets = pp_buckets;
+    p_strings->i_buckets = i_buckets;
+    return VLC_SUCCESS;
+}
+
+static listenbrainz_string_t *StringIntern(listenbrainz_strings_t *p_strings,
+                                           const char *psz)
+{
+    uint64_t i_hash = Fnv1a(FNV1A_INIT, psz, strlen(psz));
+
+    for (listenbrainz_string_t *p = p_strings->i_buckets
+            ? p_strings->pp_buckets[i_hash & (p_strings->i_buckets - 1)] : NULL;
+         p != NULL; p = p->p_next)
+        if (p->i_hash == i_hash && !strcmp(p->psz, psz))
+        {
+            p->i_refs++;
+            return p;
+        }
+
+    /* one string per bucket on average */
+    if (p_strings->i_count >= p_strings->i_buckets && StringsGrow(p_strings))
+        return NULL;
+
+    char *psz_decoded = vlc_uri_decode_duplicate(psz);
+    if (psz_decoded == NULL)
+        return NULL;
+
+    struct vlc_memstream json;
+    vlc_memstream_open(&json);
+    PutJsonString(&json, psz_decoded);
+    free(psz_decoded);
+    if (vlc_memstream_close(&json))
+        return NULL;
+
+    size_t i_len = strlen(psz);
+    listenbrainz_string_t *p_string = malloc(sizeof(*p_string) + i_len + 1
+                                             + json.length + 1);
+    if (p_string != NULL)
+    {
+        memcpy(p_string->psz, psz, i_len + 1);
+        p_string->psz_json = p_string->psz + i_len + 1;
+        memcpy(p_string->psz_json, json.ptr, json.length + 1);
+        p_string->i_json = json.length;
+        p_string->i_hash = i_hash;
+        p_string->i_refs = 1;
+
+        size_t i_bucket = i_hash & (p_strings->i_buckets - 1);
+        p_string->p_next = p_strings->pp_buckets[i_bucket];
+        p_strings->pp_buckets[i_bucket] = p_string;
+        p_strings->i_count++;
+    }
+    free(json.ptr);
+    return p_string;
+}
+
+static void StringRelease(listenbrainz_strings_t *p_strings,
+                          listenbrainz_string_t *p_string)
+{
+    if (p_string == NULL || --p_string->i_refs > 0)
+        return;
+
+    listenbrainz_string_t **pp = &p_strings->pp_buckets[p_string->i_hash
+                                                        & (p_strings->i_buckets - 1)];
+    while (*pp != p_string)
+        pp = &(*pp)->p_next;
+    *pp = p_string->p_next;
+    p_strings->i_count--;
+    free(p_string);
+}
+
+/* The JSON object of a listen, around its strings */
+#define LISTEN_DATE     "{\"listened_at\": "
+#define LISTEN_ARTIST   ", \"track_metadata\": {\"artist_name\": "
+#define LISTEN_TITLE    ", \"track_name\": "
+#define LISTEN_RELEASE  ", \"release_name\": "
+#define LISTEN_MBID     ", \"additional_info\": {\"recording_mbid\":"
+#define LISTEN_MBID_END "} "
+#define LISTEN_END      "}}"
+
+/*****************************************************************************
+ * QueueListen : make a listen of the queue out of a song, its meta data
+ * interned, p_sys->lock held
+ *****************************************************************************/
+static void DeleteListen(intf_sys_t *p_sys, listenbrainz_listen_t *p_listen)
+{
+    StringRelease(&p_sys->strings, p_listen->p_a);
+    StringRelease(&p_sys->strings, p_listen->p_t);
+    StringRelease(&p_sys->strings, p_listen->p_b);
+    StringRelease(&p_sys->strings, p_listen->p_m);
+}
+
+static int QueueListen(intf_sys_t *p_sys, const listenbrainz_song_t *p_song,
+                       listenbrainz_listen_t *p_listen)
+{
+    char psz_date[21];
+
+    *p_listen = (listenbrainz_listen_t) { .date = p_song->date };
+    p_listen->p_a = StringIntern(&p_sys->strings, p_song->psz_a);
+    p_listen->p_t = StringIntern(&p_sys->strings, p_song->psz_t);
+    if (p_song->psz_b != NULL)
+        p_listen->p_b = StringIntern(&p_sys->strings, p_song->psz_b);
+    if (p_song->psz_m != NULL)
+        p_listen->p_m = StringIntern(&p_sys->strings, p_song->psz_m);
+
+    if (!p_listen->p_a || !p_listen->p_t || (p_song->psz_b && !p_listen->p_b)
+     || (p_song->psz_m && !p_listen->p_m))
+    {
+        DeleteListen(p_sys, p_listen);
+        return VLC_ENOMEM;
+    }
+
+    p_listen->i_size = sizeof(LISTEN_DATE LISTEN_ARTIST LISTEN_TITLE LISTEN_END) - 1
+                     + snprintf(psz_date, sizeof(psz_date), "%"PRIu64,
+                                (uint64_t) p_listen->date)
+                     + p_listen->p_a->i_json + p_listen->p_t->i_json;
+    if (p_listen->p_b != NULL)
+        p_listen->i_size += sizeof(LISTEN_RELEASE) - 1 + p_listen->p_b->i_json;
+    if (p_listen->p_m != NULL)
+        p_listen->i_size += sizeof(LISTEN_MBID LISTEN_MBID_END) - 1
+                          + p_listen->p_m->i_json;
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * PutListen : write the JSON object of a listen, from the JSON forms of its
+ * interned strings
+ *****************************************************************************/
+static void PutListen(struct vlc_memstream *p_json,
+                      const listenbrainz_listen_t *p_listen)
+{
+#define PUT(str) vlc_memstream_write(p_json, str, sizeof(str) - 1)
+#define PUT_STRING(p) vlc_memstream_write(p_json, (p)->psz_json, (p)->i_json)
+
+    PUT(LISTEN_DATE);
+    vlc_memstream_printf(p_json, "%"PRIu64, (uint64_t) p_listen->date);
+    PUT(LISTEN_ARTIST);
+    PUT_STRING(p_listen->p_a);
+    PUT(LISTEN_TITLE);
+    PUT_STRING(p_listen->p_t);
+    if (p_listen->p_b != NULL)
+    {
+        PUT(LISTEN_RELEASE);
+        PUT_STRING(p_listen->p_b);
+    }
+    if (p_listen->p_m != NULL)
+    {
+        PUT(LISTEN_MBID);
+        PUT_STRING(p_listen->p_m);
+        PUT(LISTEN_MBID_END);
+    }
+    PUT(LISTEN_END);
+
+#undef PUT_STRING
+#undef PUT
+}
+
+/*****************************************************************************
+ * TrimQueue : forget the listens delivered to every endpoint
+ *****************************************************************************/
+static void TrimQueue(intf_sys_t *p_sys)
+{
+    /* keep everything until there is somewhere to submit to */
+    if (p_sys->i_endpoints == 0)
+        return;
+
+    uint64_t i_delivered = p_sys->i_queue_base + p_sys->i_songs;
+
+    for (int i = 0; i < p_sys->i_endpoints; i++)
+        i_delivered = __MIN(i_delivered, p_sys->p_endpoints[i].i_next);
+
+    int i_done = i_delivered - p_sys->i_queue_base;
+    if (i_done <= 0)
+        return;
+
+    for (int i = 0; i < i_done; i++)
+    {
+        if (p_sys->p_queue[i].i_offset > 0)
+            p_sys->pi_delivered[p_sys->p_queue[i].i_source] =
+                p_sys->p_queue[i].i_offset;
+        DeleteListen(p_sys, &p_sys->p_queue[i]);
+    }
+    p_sys->i_songs -= i_done;
+    memmove(p_sys->p_queue, p_sys->p_queue + i_done,
+            p_sys->i_songs * sizeof(*p_sys->p_queue));
+    p_sys->i_queue_base += i_done;
+
+    /* the import and the spool may queue more */
+    vlc_cond_broadcast(&p_sys->import_wait);
+}
+
+/*****************************************************************************
+ * TraceOpen : start the trace file, if one is set
+ *****************************************************************************/
+static void TraceOpen(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    char *psz_file = var_InheritString(p_intf, "listenbrainz-trace-file");
+
+    if (psz_file == NULL)
+        return;
+    if (*psz_file)
+    {
+        p_sys->p_trace = vlc_fopen(psz_file, "wt");
+        if (p_sys->p_trace == NULL)
+            msg_Warn(p_intf, "cannot write %s: %s", psz_file,
+                     vlc_strerror_c(errno));
+        else
+            fputs("[", p_sys->p_trace);
+    }
+    free(psz_file);
+}
+
+static void TraceClose(intf_sys_t *p_sys)
+{
+    if (p_sys->p_trace == NULL)
+        return;
+
+    fputs("\n]\n", p_sys->p_trace);
+    fclose(p_sys->p_trace);
+}
+
+/*****************************************************************************
+ * TraceSpan : record a span of the calling thread as a trace event. Spans of
+ * a thread nest by their times, in the Chrome trace and Perfetto viewers.
+ *****************************************************************************/
+static void TraceSpan(intf_sys_t *p_sys, const char *psz_name,
+                      mtime_t i_start, mtime_t i_end, const char *psz_host)
+{
+    struct vlc_memstream event;
+
+    if (p_sys->p_trace == NULL)
+        return;
+
+    /* the host comes from the settings: it is escaped like the payloads */
+    vlc_memstream_open(&event);
+    vlc_memstream_puts(&event, "{\"name\":");
+    PutJsonString(&event, psz_name);
+    vlc_memstream_printf(&event, ",\"cat\":\"listenbrainz\",\"ph\":\"X\","
+                         "\"ts\":%"PRId64",\"dur\":%"PRId64","
+                         "\"pid\":1,\"tid\":%lu", i_start, i_end - i_start,
+                         vlc_thread_id());
+    if (psz_host != NULL)
+    {
+        vlc_memstream_puts(&event, ",\"args\":{\"host\":");
+        PutJsonString(&event, psz_host);
+        vlc_memstream_putc(&event, '}');
+    }
+    vlc_memstream_putc(&event, '}');
+    if (vlc_memstream_close(&event))
+        return;
+
+    vlc_mutex_lock(&p_sys->trace_lock);
+    fputs(p_sys->b_traced ? ",\n" : "\n", p_sys->p_trace);
+    fwrite(event.ptr, 1, event.length, p_sys->p_trace);
+    p_sys->b_traced = true;
+    vlc_mutex_unlock(&p_sys->trace_lock);
+    free(event.ptr);
+}
+
+/*****************************************************************************
+ * RecordOpen : start the playback record file, if one is set
+ *****************************************************************************/
+static void RecordOpen(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    char *psz_file = var_InheritString(p_intf, "listenbrainz-record-file");
+
+    if (psz_file == NULL)
+        return;
+    if (*psz_file)
+    {
+        listenbrainz_record_header_t header = {
+            .psz_magic = RECORD_MAGIC,
+            .i_epoch = time(NULL),
+            .i_clock = ClockNow(),
+        };
+
+        p_sys->p_record = vlc_fopen(psz_file, "wb");
+        if (p_sys->p_record == NULL)
+            msg_Warn(p_intf, "cannot write %s: %s", psz_file,
+                     vlc_strerror_c(errno));
+        else
+            fwrite(&header, sizeof(header), 1, p_sys->p_record);
+    }
+    free(psz_file);
+}
+
+static void RecordClose(intf_sys_t *p_sys)
+{
+    if (p_sys->p_record != NULL)
+        fclose(p_sys->p_record);
+}
+
+/*****************************************************************************
+ * RecordEvent : record an event of the playlist or of the input, with the
+ * state of the input and, for item events, the meta data of its item
+ *****************************************************************************/
+static void RecordEvent(intf_sys_t *p_sys, int i_event, input_thread_t *p_input)
+{
+    listenbrainz_record_t   rec = { .i_event = i_event, .f_rate = 1.f };
+    char                    *ppsz_meta[RECORD_META] = { NULL };
+    input_item_t            *p_item = NULL;
+
+    if (p_sys->p_record == NULL)
+        return;
+
+    rec.i_date = ClockNow();
+    if (p_input != NULL)
+    {
+        rec.i_state = var_GetInteger(p_input, "state");
+        rec.i_time = var_GetInteger(p_input, "time");
+        rec.f_rate = var_GetFloat(p_input, "rate");
+        if (var_CountChoices(p_input, "video-es"))
+            rec.i_flags |= RECORD_VIDEO;
+        p_item = input_GetItem(p_input);
+    }
+
+    if (p_item != NULL && (i_event == RECORD_ITEM || i_event == RECORD_ITEM_META))
+    {
+        rec.i_length = input_item_GetDuration(p_item);
+        if (input_item_IsPreparsed(p_item))
+            rec.i_flags |= RECORD_PREPARSED;
+        if (p_item->b_net)
+            rec.i_flags |= RECORD_NET;
+
+        ppsz_meta[0] = input_item_GetURI(p_item);
+        ppsz_meta[1] = input_item_GetArtist(p_item);
+        ppsz_meta[2] = input_item_GetTitle(p_item);
+        ppsz_meta[3] = input_item_GetAlbum(p_item);
+        ppsz_meta[4] = input_item_GetTrackID(p_item);
+        ppsz_meta[5] = input_item_GetTrackNum(p_item);
+        ppsz_meta[6] = input_item_GetNowPlaying(p_item);
+        for (int i = 0; i < RECORD_META; i++)
+            rec.i_size += (ppsz_meta[i] ? strlen(ppsz_meta[i]) : 0) + 1;
+    }
+
+    vlc_mutex_lock(&p_sys->trace_lock);
+    fwrite(&rec, sizeof(rec), 1, p_sys->p_record);
+    for (int i = 0; rec.i_size && i < RECORD_META; i++)
+        fwrite(ppsz_meta[i] ? ppsz_meta[i] : "", 1,
+               (ppsz_meta[i] ? strlen(ppsz_meta[i]) : 0) + 1, p_sys->p_record);
+    vlc_mutex_unlock(&p_sys->trace_lock);
+
+    for (int i = 0; i < RECORD_META; i++)
+        free(ppsz_meta[i]);
+}
+
+/*****************************************************************************
+ * CountMetric : increment a counter, p_sys->lock must not be held
+ *****************************************************************************/
+static void CountMetric(intf_sys_t *p_sys, int i_metric)
+{
+    vlc_mutex_lock(&p_sys->lock);
+    p_sys->pi_metrics[i_metric]++;
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+static void RecordLatency(intf_sys_t *p_sys, int i_latency, mtime_t i_elapsed)
+{
+    uint64_t i_ms = i_elapsed / 1000;
+    size_t i_bucket = 0;
+
+    while (i_bucket < ARRAY_SIZE(pi_latency_bounds)
+        && i_ms > pi_latency_bounds[i_bucket])
+        i_bucket++;
+
+    vlc_mutex_lock(&p_sys->lock);
+    p_sys->p_latency[i_latency].pi_buckets[i_bucket]++;
+    p_sys->p_latency[i_latency].i_sum += i_ms;
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+static void SnapshotMetrics(intf_sys_t *p_sys, uint64_t *pi_values,
+                            listenbrainz_histogram_t *p_latency)
+{
+    vlc_mutex_lock(&p_sys->lock);
+    memcpy(pi_values, p_sys->pi_metrics, sizeof(p_sys->pi_metrics));
+    memcpy(p_latency, p_sys->p_latency, sizeof(p_sys->p_latency));
+
+    pi_values[METRIC_QUEUE_DEPTH] = p_sys->i_songs;
+    pi_values[METRIC_QUEUE_BYTES] = 0;
+    for (int i = 0; i < p_sys->i_songs; i++)
+        pi_values[METRIC_QUEUE_BYTES] += p_sys->p_queue[i].i_size;
+    pi_values[METRIC_QUEUE_OLDEST] = p_sys->i_songs ? p_sys->p_queue[0].date : 0;
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+/*****************************************************************************
+ * PublishMetrics : update the variables of the metrics
+ *****************************************************************************/
+static void PublishMetrics(intf_thread_t *p_intf)
+{
+    uint64_t                    pi_values[METRIC_COUNT];
+    listenbrainz_histogram_t    p_latency[LATENCY_COUNT];
+
+    SnapshotMetrics(p_intf->p_sys, pi_values, p_latency);
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+        var_SetInteger(p_intf->obj.libvlc, p_metrics[i].psz_var, pi_values[i]);
+
+    /* histograms are strings of the cumulative count per upper bound, then
+     * the sum, all in milliseconds: "10:1 25:3 ... inf:7 sum:1234" */
+    for (int i = 0; i < LATENCY_COUNT; i++)
+    {
+        struct vlc_memstream ms;
+        uint64_t i_count = 0;
+
+        vlc_memstream_open(&ms);
+        for (size_t j = 0; j < LATENCY_BUCKETS; j++)
+        {
+            i_count += p_latency[i].pi_buckets[j];
+            if (j < ARRAY_SIZE(pi_latency_bounds))
+                vlc_memstream_printf(&ms, "%u:%"PRIu64" ",
+                                     pi_latency_bounds[j], i_count);
+            else
+                vlc_memstream_printf(&ms, "inf:%"PRIu64" ", i_count);
+        }
+        vlc_memstream_printf(&ms, "sum:%"PRIu64, p_latency[i].i_sum);
+
+        if (vlc_memstream_close(&ms) == 0)
+        {
+            var_SetString(p_intf->obj.libvlc, p_latencies[i].psz_var, ms.ptr);
+            free(ms.ptr);
+        }
+    }
+}
+
+/*****************************************************************************
+ * ExportMetrics : write the metrics to the metrics file
+ *****************************************************************************/
+static void ExportMetrics(intf_thread_t *p_intf)
+{
+    intf_sys_t                  *p_sys = p_intf->p_sys;
+    uint64_t                    pi_values[METRIC_COUNT];
+    listenbrainz_histogram_t    p_latency[LATENCY_COUNT];
+    char                        *psz_tmp;
+
+    SnapshotMetrics(p_sys, pi_values, p_latency);
+
+    /* write aside then rename, so that readers never see a partial file */
+    if (asprintf(&psz_tmp, "%s.tmp", p_sys->psz_metrics_file) == -1)
+        return;
+
+    FILE *p_file = vlc_fopen(psz_tmp, "wt");
+    if (p_file == NULL)
+    {
+        msg_Warn(p_intf, "cannot write %s: %s", psz_tmp, vlc_strerror_c(errno));
+        free(psz_tmp);
+        return;
+    }
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        const char *psz_name = p_metrics[i].psz_name;
+        int i_family = strcspn(psz_name, "{");
+
+        /* samples of a family with labels share the type line */
+        if (i == 0 || strncmp(psz_name, p_metrics[i - 1].psz_name, i_family)
+         || (p_metrics[i - 1].psz_name[i_family] != '{'
+          && p_metrics[i - 1].psz_name[i_family] != '\0'))
+            fprintf(p_file, "# TYPE %.*s %s\n", i_family, psz_name,
+                    p_metrics[i].psz_type);
+        fprintf(p_file, "%s %"PRIu64"\n", psz_name, pi_values[i]);
+    }
+
+    /* in seconds, written by hand to stay clear of the decimal separator of
+     * the locale */
+    fputs("# TYPE listenbrainz_latency_seconds histogram\n", p_file);
+    for (int i = 0; i < LATENCY_COUNT; i++)
+    {
+        const char *psz_phase = p_latencies[i].psz_phase;
+        uint64_t i_count = 0;
+
+        for (size_t j = 0; j < LATENCY_BUCKETS; j++)
+        {
+            i_count += p_latency[i].pi_buckets[j];
+            if (j < ARRAY_SIZE(pi_latency_bounds))
+                fprintf(p_file, "listenbrainz_latency_seconds_bucket"
+                        "{phase=\"%s\",le=\"%u.%03u\"} %"PRIu64"\n", psz_phase,
+                        pi_latency_bounds[j] / 1000, pi_latency_bounds[j] % 1000,
+                        i_count);
+            else
+                fprintf(p_file, "listenbrainz_latency_seconds_bucket"
+                        "{phase=\"%s\",le=\"+Inf\"} %"PRIu64"\n", psz_phase,
+                        i_count);
+        }
+        fprintf(p_file, "listenbrainz_latency_seconds_sum{phase=\"%s\"} "
+                "%"PRIu64".%03u\n", psz_phase, p_latency[i].i_sum / 1000,
+                (unsigned) (p_latency[i].i_sum % 1000));
+        fprintf(p_file, "listenbrainz_latency_seconds_count{phase=\"%s\"} "
+                "%"PRIu64"\n", psz_phase, i_count);
+    }
+
+    bool b_error = ferror(p_file);
+    if (fclose(p_file))
+        b_error = true;
+    if (b_error || vlc_rename(psz_tmp, p_sys->psz_metrics_file))
+    {
+        msg_Warn(p_intf, "cannot write %s", p_sys->psz_metrics_file);
+        vlc_unlink(psz_tmp);
+    }
+    free(psz_tmp);
+}
+
+static void MetricsTimer(void *data)
+{
+    ExportMetrics(data);
+}
+
+/*****************************************************************************
+ * DropOldest : make room in a full queue. The oldest listen is dropped for
+ * the endpoints lagging behind, provided another endpoint delivered it
+ *****************************************************************************/
+static bool DropOldest(intf_thread_t *p_this)
+{
+    intf_sys_t *p_sys = p_this->p_sys;
+    uint64_t    i_head = p_sys->i_queue_base;
+    bool        b_delivered = false;
+
+    for (int i = 0; i < p_sys->i_endpoints; i++)
+        if (p_sys->p_endpoints[i].i_next > i_head)
+            b_delivered = true;
+    if (!b_delivered)
+        return false;
+
+    for (int i = 0; i < p_sys->i_endpoints; i++)
+    {
+        listenbrainz_endpoint_t *p_ep = &p_sys->p_endpoints[i];
+        if (p_ep->i_next == i_head)
+        {
+            msg_Warn(p_this, "%s is lagging behind, dropping a listen for it",
+                     p_ep->psz_name);
+            p_ep->i_next++;
+            p_sys->pi_metrics[METRIC_DROPS]++;
+        }
+    }
+    TrimQueue(p_sys);
+    return true;
+}
+
+/*****************************************************************************
+ * IsStream : tell a stream, which plays several tracks, from a single file
+ *****************************************************************************/
+static bool IsStream(input_item_t *p_item)
+{
+    if (!p_item->b_net)
+        return false;
+
+    /* a file shared over the network has a length, a radio has none unless
+     * it announces the track it is playing */
+    if (input_item_GetDuration(p_item) <= 0)
+        return true;
+
+    char *psz_np = input_item_GetNowPlaying(p_item);
+    bool b_stream = psz_np != NULL && *psz_np;
+    free(psz_np);
+    return b_stream;
+}
+
+/*****************************************************************************
+ * FillStreamSong : make the current song of the stream meta data last seen.
+ * Radios usually announce "Artist - Title" as the "now playing" meta data.
+ * Must be called with p_sys->lock held.
+ *****************************************************************************/
+static void FillStreamSong(intf_thread_t *p_this)
+{
+    intf_sys_t          *p_sys  = p_this->p_sys;
+    listenbrainz_song_t *p_song = &p_sys->p_current_song;
+    const char          *psz_np = p_sys->psz_stream_np;
+    const char          *psz_sep = psz_np ? strstr(psz_np, " - ") : NULL;
+
+    DeleteSong(p_song);
+    p_song->i_l = 0;
+    p_sys->b_meta_read = true;
+
+    if (psz_sep != NULL)
+    {
+        char *psz_a = strndup(psz_np, psz_sep - psz_np);
+        if (psz_a)
+            p_song->psz_a = vlc_uri_encode(psz_a);
+        free(psz_a);
+        p_song->psz_t = vlc_uri_encode(psz_sep + 3);
+    }
+    else if (p_sys->psz_stream_a && p_sys->psz_stream_t)
+    {
+        p_song->psz_a = vlc_uri_encode(p_sys->psz_stream_a);
+        p_song->psz_t = vlc_uri_encode(p_sys->psz_stream_t);
+    }
+
+    if (!p_song->psz_a || !*p_song->psz_a || !p_song->psz_t || !*p_song->psz_t)
+    {
+        msg_Dbg(p_this, "No artist or track name in the stream meta data");
+        DeleteSong(p_song);
+        return;
+    }
+
+    p_sys->b_submit_nowp = true;
+    msg_Dbg(p_this, "Stream track registered");
+    vlc_cond_signal(&p_sys->wait);
+}
+
+/*****************************************************************************
+ * ReadMetaData : Read meta data when parsed by vlc
+ *****************************************************************************/
+static void ReadMetaData(intf_thread_t *p_this, input_thread_t *p_input,
+                         bool b_parsed)
+{
+    intf_sys_t *p_sys = p_this->p_sys;
+    uint64_t   i_key = 0;
+    int64_t    i_mtime = 0;
+
+    assert(p_input != NULL);
+
+    input_item_t *p_item = input_GetItem(p_input);
+    if (p_item == NULL)
+        return;
+
+    mtime_t i_span = mdate();
+    bool b_local = p_sys->meta_cache.p_header != NULL
+                && MetaCacheKey(p_item, &i_key, &i_mtime);
+    bool b_stream = IsStream(p_item);
+
+#define ALLOC_ITEM_META(a, b) do { \
+        char *psz_meta = input_item_Get##b(p_item); \
+        if (psz_meta && *psz_meta) \
+            a = vlc_uri_encode(psz_meta); \
+        free(psz_meta); \
+    } while (0)
+
+    vlc_mutex_lock(&p_sys->lock);
+
+    /* streams announce their tracks through meta data changes */
+    if (b_stream && (p_sys->psz_stream_np || p_sys->psz_stream_a
+                  || p_sys->psz_stream_t))
+    {
+        FillStreamSong(p_this);
+        goto end;
+    }
+
+    if (b_local && MetaCacheRead(&p_sys->meta_cache, i_key, i_mtime,
+                                 &p_sys->p_current_song))
+    {
+        p_sys->b_meta_read = true;
+        p_sys->b_submit_nowp = true;
+        msg_Dbg(p_this, "Meta data registered from the cache");
+        vlc_cond_signal(&p_sys->wait);
+        goto end;
+    }
+
+    /* until it is preparsed, the item only knows its file name */
+    if (!b_parsed)
+        goto end;
+
+    p_sys->b_meta_read = true;
+
+    ALLOC_ITEM_META(p_sys->p_current_song.psz_a, Artist);
+    if (!p_sys->p_current_song.psz_a)
+    {
+        msg_Dbg(p_this, "No artist..");
+        DeleteSong(&p_sys->p_current_song);
+        goto end;
+    }
+
+    ALLOC_ITEM_META(p_sys->p_current_song.psz_t, Title);
+    if (!p_sys->p_current_song.psz_t)
+    {
+        msg_Dbg(p_this, "No track name..");
+        DeleteSong(&p_sys->p_current_song);
+        goto end;
+    }
+
+    /* Now we have read the mandatory meta data, so we can submit that info */
+    p_sys->b_submit_nowp = true;
+
+    ALLOC_ITEM_META(p_sys->p_current_song.psz_b, Album);
+    ALLOC_ITEM_META(p_sys->p_current_song.psz_m, TrackID);
+    ALLOC_ITEM_META(p_sys->p_current_song.psz_n, TrackNum);
+
+    p_sys->p_current_song.i_l = input_item_GetDuration(p_item) / 1000000;
+
+#undef ALLOC_ITEM_META
+
+    if (b_local)
+        MetaCacheWrite(&p_sys->meta_cache, i_key, i_mtime,
+                       &p_sys->p_current_song);
+
+    msg_Dbg(p_this, "Meta data registered");
+
+    vlc_cond_signal(&p_sys->wait);
+
+    end:
+    vlc_mutex_unlock(&p_sys->lock);
+    TraceSpan(p_sys, "ReadMetaData", i_span, mdate(), NULL);
+}
+
+/*****************************************************************************
+ * AccountPlayedTime : add how far the media played since the last clock point.
+ * Stalls and pauses do not move the media time, and seeks move it faster than
+ * the playback rate allows, so neither counts as listening.
+ * Must be called with p_sys->lock held.
+ *****************************************************************************/
+static void AccountPlayedTime(intf_sys_t *p_sys, mtime_t i_ts, mtime_t i_system,
+                              double f_rate)
+{
+    if (p_sys->b_clock)
+    {
+        mtime_t    i_played = i_ts - p_sys->i_clock_ts;
+        mtime_t    i_elapsed = i_system - p_sys->i_clock_system;
+
+        if (i_played > 0 && i_played <= i_elapsed * f_rate + CLOCK_SLACK)
+            p_sys->i_played += i_played;
+    }
+    p_sys->i_clock_ts = i_ts;
+    p_sys->i_clock_system = i_system;
+    p_sys->b_clock = true;
+}
+
+/* Start accounting for a new listen. Must be called with p_sys->lock held. */
+static void ResetPlayedTime(intf_sys_t *p_sys)
+{
+    p_sys->i_played = 0;
+    p_sys->b_clock = false;
+}
+
+/*****************************************************************************
+ * SpoolOpen : join the spool directory, if one is set. The instance which gets
+ * the lock of the directory is the one to submit the listens of all of them.
+ *****************************************************************************/
+static void SpoolOpen(intf_thread_t *p_intf)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    char        *psz_dir = var_InheritString(p_intf, "listenbrainz-spool");
+
+    if (psz_dir == NULL || !*psz_dir)
+    {
+        free(psz_dir);
+        return;
+    }
+#ifndef _WIN32
+    char *psz_lock;
+
+    vlc_mkdir(psz_dir, 0700);
+    if (asprintf(&psz_lock, "%s" DIR_SEP SPOOL_LOCK, psz_dir) == -1)
+    {
+        free(psz_dir);
+        return;
+    }
+
+    p_sys->i_spool_fd = vlc_open(psz_lock, O_RDWR | O_CREAT, 0600);
+    if (p_sys->i_spool_fd == -1)
+    {
+        msg_Err(p_intf, "cannot open %s: %s", psz_lock, vlc_strerror_c(errno));
+        free(psz_lock);
+        free(psz_dir);
+        return;
+    }
+    free(psz_lock);
+
+    p_sys->psz_spool = psz_dir;
+    p_sys->i_spool_id = getpid();
+    p_sys->b_leader = SpoolLock(p_sys->i_spool_fd);
+    msg_Dbg(p_intf, "%s the listens of the spool %s",
+            p_sys->b_leader ? "submitting" : "writing", psz_dir);
+#else
+    msg_Warn(p_intf, "the listen spool is not supported on this system");
+    free(psz_dir);
+#endif
+}
+
+/*****************************************************************************
+ * SpoolClose : leave the spool, to another instance if this one submitted it
+ *****************************************************************************/
+static void SpoolClose(intf_sys_t *p_sys)
+{
+    if (p_sys->psz_spool == NULL)
+        return;
+    vlc_close(p_sys->i_spool_fd);
+    FREENULL(p_sys->psz_spool);
+}
+
+/*****************************************************************************
+ * SpoolWrite : write a listen to the spool, as a segment file of its own.
+ * Written aside then renamed, a segment is read whole or not at all.
+ * Must be called with p_sys->lock held.
+ *****************************************************************************/
+static int SpoolWrite(intf_thread_t *p_intf, const listenbrainz_song_t *p_song)
+{
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_listen_t   listen;
+    struct vlc_memstream    json;
+    char                    *psz_file, *psz_tmp;
+    int                     i_ret = VLC_EGENERIC;
+
+    if (QueueListen(p_sys, p_song, &listen))
+        return VLC_ENOMEM;
+    vlc_memstream_open(&json);
+    PutListen(&json, &listen);
+    vlc_memstream_putc(&json, '\n');
+    DeleteListen(p_sys, &listen);
+    if (vlc_memstream_close(&json))
+        return VLC_ENOMEM;
+
+    /* named after the date of the listen, the oldest are submitted first */
+    if (asprintf(&psz_file, "%s" DIR_SEP "%016"PRIx64"-%lu-%u" SPOOL_SUFFIX,
+                 p_sys->psz_spool, (uint64_t) p_song->date, p_sys->i_spool_id,
+                 p_sys->i_spooled++) == -1)
+    {
+        free(json.ptr);
+        return VLC_ENOMEM;
+    }
+    if (asprintf(&psz_tmp, "%s.tmp", psz_file) == -1)
+    {
+        free(psz_file);
+        free(json.ptr);
+        return VLC_ENOMEM;
+    }
+
+    FILE *p_file = vlc_fopen(psz_tmp, "wb");
+    if (p_file != NULL)
+    {
+        bool b_error = fwrite(json.ptr, 1, json.length, p_file) != json.length;
+        if (fclose(p_file))
+            b_error = true;
+        if (!b_error && !vlc_rename(psz_tmp, psz_file))
+            i_ret = VLC_SUCCESS;
+        else
+            vlc_unlink(psz_tmp);
+    }
+    if (i_ret != VLC_SUCCESS)
+        msg_Warn(p_intf, "cannot write %s: %s", psz_file, vlc_strerror_c(errno));
+    free(psz_tmp);
+    free(psz_file);
+    free(json.ptr);
+    return i_ret;
+}
+
+/*****************************************************************************
+ * ServeSocket : listen on the local socket at psz_path, -1 on error. Only the
+ * user may connect to it, as what it accepts is submitted with their token.
+ *****************************************************************************/
+static int ServeSocket(intf_thread_t *p_intf, const char *psz_path)
+{
+#ifndef _WIN32
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(psz_path) >= sizeof(addr.sun_path))
+    {
+        msg_Err(p_intf, "socket path too long: %s", psz_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, psz_path);
+
+    /* a socket left by an instance which did not exit cleanly is replaced,
+     * not one another instance still listens on */
+    int i_fd = vlc_socket(PF_LOCAL, SOCK_STREAM, 0, false);
+    if (i_fd == -1)
+        goto error;
+    int i_ret = connect(i_fd, (struct sockaddr *) &addr, sizeof(addr));
+    int i_errno = errno;
+    net_Close(i_fd);
+    if (i_ret == 0)
+    {
+        msg_Err(p_intf, "cannot listen on %s: another instance does",
+                psz_path);
+        return -1;
+    }
+    if (i_errno == ECONNREFUSED)
+        vlc_unlink(psz_path);
+
+    /* no connection is accepted before listen(), hence after the chmod() */
+    i_fd = vlc_socket(PF_LOCAL, SOCK_STREAM, 0, false);
+    if (i_fd == -1)
+        goto error;
+    if (bind(i_fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        i_errno = errno;
+        net_Close(i_fd);
+        errno = i_errno;
+        goto error;
+    }
+    if (chmod(psz_path, 0600) || listen(i_fd, SERVE_CLIENTS))
+    {
+        i_errno = errno;
+        net_Close(i_fd);
+        vlc_unlink(psz_path);
+        errno = i_errno;
+        goto error;
+    }
+    return i_fd;
+
+error:
+    msg_Err(p_intf, "cannot listen on %s: %s", psz_path,
+            vlc_strerror_c(errno));
+    return -1;
+#else
+    msg_Warn(p_intf, "cannot listen on %s: not supported on this system",
+             psz_path);
+    return -1;
+#endif
+}
+
+/*****************************************************************************
+ * ServeOpen : listen for the listens of other instances on the socket of the
+ * helper, if this instance is one, and for those of other players on the
+ * ingest socket, if set
+ *****************************************************************************/
+static void ServeOpen(intf_thread_t *p_intf)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    char        *psz_serve = var_InheritString(p_intf, "listenbrainz-serve");
+    char        *psz_ingest = var_InheritString(p_intf, "listenbrainz-ingest");
+
+    p_sys->i_serve_fd = p_sys->i_ingest_fd = -1;
+    if (!EMPTY_STR(psz_serve)
+     && (p_sys->i_serve_fd = ServeSocket(p_intf, psz_serve)) != -1)
+    {
+        msg_Dbg(p_intf, "submitting the listens handed to %s", psz_serve);
+        p_sys->psz_serve = psz_serve;
+        psz_serve = NULL;
+    }
+    if (!EMPTY_STR(psz_ingest)
+     && (p_sys->i_ingest_fd = ServeSocket(p_intf, psz_ingest)) != -1)
+    {
+        msg_Dbg(p_intf, "submitting the listens of other players sent to %s",
+                psz_ingest);
+        p_sys->psz_ingest = psz_ingest;
+        psz_ingest = NULL;
+    }
+    free(psz_serve);
+    free(psz_ingest);
+
+    if (p_sys->psz_serve != NULL || p_sys->psz_ingest != NULL)
+    {
+        p_sys->p_serve_interrupt = vlc_interrupt_create();
+        if (p_sys->p_serve_interrupt == NULL)
+            ServeClose(p_sys);
+    }
+}
+
+/*****************************************************************************
+ * ServeClose : stop listening on the sockets
+ *****************************************************************************/
+static void ServeClose(intf_sys_t *p_sys)
+{
+    if (p_sys->psz_serve != NULL)
+    {
+        net_Close(p_sys->i_serve_fd);
+        vlc_unlink(p_sys->psz_serve);
+        FREENULL(p_sys->psz_serve);
+    }
+    if (p_sys->psz_ingest != NULL)
+    {
+        net_Close(p_sys->i_ingest_fd);
+        vlc_unlink(p_sys->psz_ingest);
+        FREENULL(p_sys->psz_ingest);
+    }
+    if (p_sys->p_serve_interrupt != NULL)
+    {
+        vlc_interrupt_destroy(p_sys->p_serve_interrupt);
+        p_sys->p_serve_interrupt = NULL;
+    }
+}
+
+/*****************************************************************************
+ * EnqueueSong : write a listen to the spool, or else queue it for the
+ * endpoints. Must be called with p_sys->lock held.
+ *****************************************************************************/
+static void EnqueueSong(intf_thread_t *p_this,
+                        const listenbrainz_song_t *p_song)
+{
+    intf_sys_t *p_sys = p_this->p_sys;
+
+    /* the instance submitting the spool finds the duplicates, there */
+    if (p_sys->psz_spool != NULL && SpoolWrite(p_this, p_song) == VLC_SUCCESS)
+    {
+        msg_Dbg(p_this, "Song written to the spool.");
+        vlc_cond_broadcast(&p_sys->import_wait);
+        return;
+    }
+
+    /* The same play may be reported twice, e.g. by a track change followed by
+     * a stop event: only the first one becomes a listen, and the second does
+     * not make room for itself in a full queue */
+    uint64_t i_hash = HashListen(p_song);
+    if (!DedupInsert(&p_sys->dedup, i_hash))
+    {
+        msg_Dbg(p_this, "Listen already queued, not submitting");
+        return;
+    }
+
+    /* a listen not queued may be reported again */
+    if (p_sys->i_songs >= QUEUE_MAX && !DropOldest(p_this))
+    {
+        msg_Warn(p_this, "Submission queue is full, not submitting");
+        p_sys->pi_metrics[METRIC_DROPS]++;
+        DedupRemove(&p_sys->dedup, i_hash);
+        return;
+    }
+
+    msg_Dbg(p_this, "Song will be submitted.");
+
+    if (QueueListen(p_sys, p_song, &p_sys->p_queue[p_sys->i_songs]))
+    {
+        DedupRemove(&p_sys->dedup, i_hash);
+        return;
+    }
+
+    p_sys->i_songs++;
+
+    /* signal the endpoints we have something to submit */
+    vlc_cond_broadcast(&p_sys->wait);
+}
+
+/*****************************************************************************
+ * AddToQueue: Add the played song to the queue to be submitted
+ *****************************************************************************/
+static void AddToQueue (intf_thread_t *p_this)
+{
+    mtime_t                     played_time;
+    intf_sys_t                  *p_sys = p_this->p_sys;
+    mtime_t                     i_span = mdate();
+
+    vlc_mutex_lock(&p_sys->lock);
+
+    /* Check that we have the mandatory meta data */
+    if (!p_sys->p_current_song.psz_t || !p_sys->p_current_song.psz_a)
+        goto end;
+
+    /* wait for the user to listen enough before submitting */
+    played_time = p_sys->i_played / 1000000;
+
+    /*HACK: it seam that the preparsing sometime fail,
+            so use the playing time as the song length */
+    if (p_sys->p_current_song.i_l == 0)
+        p_sys->p_current_song.i_l = played_time;
+
+    /* Don't send song shorter than 30s */
+    if (p_sys->p_current_song.i_l < 30)
+    {
+        msg_Dbg(p_this, "Song too short (< 30s), not submitting");
+        goto end;
+    }
+
+    /* Send if the user had listen more than 240s OR half the track length */
+    if ((played_time < 240) &&
+        (played_time < (p_sys->p_current_song.i_l / 2)))
+    {
+        msg_Dbg(p_this, "Song not listened long enough, not submitting");
+        goto end;
+    }
+
+    /* Check that all meta are present */
+    if (!p_sys->p_current_song.psz_a || !*p_sys->p_current_song.psz_a ||
+        !p_sys->p_current_song.psz_t || !*p_sys->p_current_song.psz_t)
+    {
+        msg_Dbg(p_this, "Missing artist or title, not submitting");
+        goto end;
+    }
+
+    EnqueueSong(p_this, &p_sys->p_current_song);
+
+    end:
+    DeleteSong(&p_sys->p_current_song);
+    vlc_mutex_unlock(&p_sys->lock);
+    TraceSpan(p_sys, "AddToQueue", i_span, mdate(), NULL);
+}
+
+/*****************************************************************************
+ * StreamMetaChange : follow the tracks of a stream through its meta data
+ *****************************************************************************/
+static void StreamMetaChange(intf_thread_t *p_this, input_item_t *p_item)
+{
+    intf_sys_t  *p_sys = p_this->p_sys;
+    bool        b_changed = false;
+
+    /* files have a single track, whatever the preparser adds to them */
+    if (p_item == NULL || !IsStream(p_item))
+        return;
+
+    char *ppsz_new[] = { input_item_GetNowPlaying(p_item),
+                         input_item_GetArtist(p_item),
+                         input_item_GetTitle(p_item) };
+
+    vlc_mutex_lock(&p_sys->lock);
+
+    char **pppsz_seen[] = { &p_sys->psz_stream_np, &p_sys->psz_stream_a,
+                            &p_sys->psz_stream_t };
+    bool b_playing = p_sys->psz_stream_np || p_sys->psz_stream_a
+                  || p_sys->psz_stream_t;
+
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_new); i++)
+    {
+        if (ppsz_new[i] && !*ppsz_new[i])
+            FREENULL(ppsz_new[i]);
+
+        if (ppsz_new[i] == *pppsz_seen[i]
+         || (ppsz_new[i] && *pppsz_seen[i] && !strcmp(ppsz_new[i], *pppsz_seen[i])))
+        {
+            free(ppsz_new[i]);
+            continue;
+        }
+        free(*pppsz_seen[i]);
+        *pppsz_seen[i] = ppsz_new[i];
+        b_changed = true;
+    }
+
+    vlc_mutex_unlock(&p_sys->lock);
+
+    if (!b_changed)
+        return;
+
+    /* a new track started: the previous one is a listen of its own */
+    if (b_playing)
+        AddToQueue(p_this);
+
+    vlc_mutex_lock(&p_sys->lock);
+    if (b_playing)
+    {
+        ClockTime(&p_sys->p_current_song.date);
+        ResetPlayedTime(p_sys);
+    }
+    FillStreamSong(p_this);
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+/*****************************************************************************
+ * PrefetchTimer : have VLC preparse the next items of the playlist in the
+ * background, so that their meta data is ready the instant they start. It
+ * runs on a thread of its own, not to lock the playlist from the callbacks,
+ * whose callers may hold it or wait on them with it held.
+ *****************************************************************************/
+static void PrefetchTimer(void *data)
+{
+    intf_thread_t   *p_intf = data;
+    intf_sys_t      *p_sys = p_intf->p_sys;
+    playlist_t      *p_playlist = pl_Get(p_intf);
+    input_item_t    *pp_items[PREFETCH_MAX];
+    int             i_items = 0;
+
+    PL_LOCK;
+    for (int i = 1; i <= p_sys->i_prefetch; i++)
+    {
+        int i_index = p_playlist->i_current_index + i;
+        if (i_index < 0 || i_index >= p_playlist->current.i_size)
+            break;
+
+        input_item_t *p_item = p_playlist->current.p_elems[i_index]->p_input;
+        if (!input_item_IsPreparsed(p_item))
+            pp_items[i_items++] = input_item_Hold(p_item);
+    }
+    PL_UNLOCK;
+
+    for (int i = 0; i < i_items; i++)
+    {
+        libvlc_MetadataRequest(p_intf->obj.libvlc, pp_items[i],
+                               META_REQUEST_OPTION_SCOPE_ANY, -1, p_intf);
+        input_item_Release(pp_items[i]);
+    }
+}
+
+/*****************************************************************************
+ * PlayingChange: Playing status change callback
+ *****************************************************************************/
+static int PlayingChange(vlc_object_t *p_this, const char *psz_var,
+                         vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    VLC_UNUSED(oldval);
+
+    intf_thread_t   *p_intf = (intf_thread_t*) p_data;
+    intf_sys_t      *p_sys  = p_intf->p_sys;
+    input_thread_t  *p_input = (input_thread_t*)p_this;
+    int             state;
+
+    VLC_UNUSED(psz_var);
+
+    if (newval.i_int == INPUT_EVENT_ITEM_META)
+    {
+        RecordEvent(p_sys, RECORD_ITEM_META, p_input);
+        if (!var_CountChoices(p_input, "video-es"))
+            StreamMetaChange(p_intf, input_GetItem(p_input));
+        return VLC_SUCCESS;
+    }
+
+    if (newval.i_int == INPUT_EVENT_POSITION)
+    {
+        RecordEvent(p_sys, RECORD_POSITION, p_input);
+        vlc_mutex_lock(&p_sys->lock);
+        AccountPlayedTime(p_sys, var_GetInteger(p_input, "time"), ClockNow(),
+                          var_GetFloat(p_input, "rate"));
+        vlc_mutex_unlock(&p_sys->lock);
+        return VLC_SUCCESS;
+    }
+
+    if (newval.i_int != INPUT_EVENT_STATE) return VLC_SUCCESS;
+    RecordEvent(p_sys, RECORD_STATE, p_input);
+
+    if (var_CountChoices(p_input, "video-es"))
+    {
+        msg_Dbg(p_this, "Not an audio-only input, not submitting");
+        return VLC_SUCCESS;
+    }
+
+    state = var_GetInteger(p_input, "state");
+
+    if (!p_sys->b_meta_read && state >= PLAYING_S)
+    {
+        ReadMetaData(p_intf, p_input, true);
+        return VLC_SUCCESS;
     }
 
 
     if (state >= END_S)
         AddToQueue(p_intf);
     else if (state == PAUSE_S)
-        p_sys->time_pause = mdate();
+        p_sys->time_pause = ClockNow();
     else if (state == PLAYING_S) {
         if (p_sys->time_pause > 0) {
-            mtime_t current_time = mdate();
-            mtime_t time_paused = current_time - p_sys->time_pause;
-            p_sys->time_total_pauses += time_paused;
+            mtime_t time_paused = ClockNow() - p_sys->time_pause;
+
+            msg_Dbg(p_intf, "Pause duration: %"PRIu64, (time_paused / 1000000));
+            //check whether duration of pause is more than 60s
+            if ((time_paused / 1000000) > 60) {
+                vlc_mutex_lock(&p_sys->lock);
+                int64_t played_time = p_sys->i_played / 1000000;
+                vlc_mutex_unlock(&p_sys->lock);
+                //check whether the item as of now qualifies as a listen
+                if ((played_time > 30) &&
+                    (played_time > 240 || played_time >= p_sys->p_current_song.i_l / 2)) {
+                    AddToQueue(p_intf);
+                    ReadMetaData(p_intf, p_input, true);
+                    vlc_mutex_lock(&p_sys->lock);
+                    ClockTime(&p_sys->p_current_song.date);
+                    ResetPlayedTime(p_sys);
+                    vlc_mutex_unlock(&p_sys->lock);
+                }
+            }
+            p_sys->time_pause = 0;
+        }
+    }
+
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * ItemChange: Playlist item change callback
+ *****************************************************************************/
+static int ItemChange(vlc_object_t *p_this, const char *psz_var,
+                      vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    intf_thread_t  *p_intf  = p_data;
+    intf_sys_t     *p_sys   = p_intf->p_sys;
+    input_thread_t *p_input = newval.p_address;
+
+    VLC_UNUSED(psz_var);
+    VLC_UNUSED(oldval);
+
+    RecordEvent(p_sys, RECORD_ITEM, p_input);
+
+    p_sys->b_meta_read      = false;
+
+    vlc_mutex_lock(&p_sys->lock);
+    FREENULL(p_sys->psz_stream_np);
+    FREENULL(p_sys->psz_stream_a);
+    FREENULL(p_sys->psz_stream_t);
+    vlc_mutex_unlock(&p_sys->lock);
+
+    if (p_sys->p_input != NULL)
+    {
+        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
+        vlc_object_release(p_sys->p_input);
+        p_sys->p_input = NULL;
+    }
+
+    if (p_input == NULL)
+        return VLC_SUCCESS;
+
+    input_item_t *p_item = input_GetItem(p_input);
+    if (p_item == NULL)
+        return VLC_SUCCESS;
+
+    if (p_sys->i_prefetch > 0)
+        vlc_timer_schedule(p_sys->prefetch_timer, false, 1, 0);
+
+    if (var_CountChoices(p_input, "video-es"))
+    {
+        msg_Dbg(p_this, "Not an audio-only input, not submitting");
+        return VLC_SUCCESS;
+    }
+
+    vlc_mutex_lock(&p_sys->lock);
+    ClockTime(&p_sys->p_current_song.date);   /* to be sent to ListenBrainz */
+    ResetPlayedTime(p_sys);
+    vlc_mutex_unlock(&p_sys->lock);
+
+    p_sys->p_input = vlc_object_hold(p_input);
+    var_AddCallback(p_input, "intf-event", PlayingChange, p_intf);
+
+    ReadMetaData(p_intf, p_input, input_item_IsPreparsed(p_item));
+    /* if the input item was neither preparsed nor cached, we'll do it in
+     * PlayingChange() callback, when "state" == PLAYING_S */
+
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * AddEndpoint : register a server to submit listens to
+ *****************************************************************************/
+static int AddEndpoint(intf_thread_t *p_intf, listenbrainz_endpoint_t **pp_eps,
+                       int *pi_eps, const char *psz_host, const char *psz_token)
+{
+    listenbrainz_endpoint_t     *p_ep;
+    char                        *psz_url;
+    int                         i_ret;
+
+    p_ep = realloc(*pp_eps, (*pi_eps + 1) * sizeof(*p_ep));
+    if (!p_ep)
+        return VLC_ENOMEM;
+    *pp_eps = p_ep;
+    p_ep += *pi_eps;
+    memset(p_ep, 0, sizeof(*p_ep));
+    p_ep->i_fd = -1;
+
+    /* the local sinks are given as the URL of their path, and the requests
+     * over a local socket are to localhost */
+    p_ep->p_sink = &p_sinks[SINK_HTTP];
+    for (int i = 0; i < SINK_COUNT; i++)
+    {
+        size_t i_scheme = strlen(p_sinks[i].psz_scheme);
+        if (i != SINK_HTTP && !strncasecmp(psz_host, p_sinks[i].psz_scheme,
+                                           i_scheme)
+         && !strncmp(psz_host + i_scheme, "://", 3))
+            p_ep->p_sink = &p_sinks[i];
+    }
+    if (p_ep->p_sink == &p_sinks[SINK_FILE])
+        p_ep->psz_path = vlc_uri2path(psz_host);
+    else if (p_ep->p_sink == &p_sinks[SINK_UNIX])
+        p_ep->psz_path = vlc_uri_decode_duplicate(psz_host + strlen("unix://"));
+    if (p_ep->psz_path != NULL)
+        psz_host = "http://localhost";
+
+    /* a bare host name is the usual https server, local test servers are
+     * given with their scheme and port */
+    if (asprintf(&psz_url, "%s%s/1/submit-listens",
+                 strstr(psz_host, "://") ? "" : "https://", psz_host) == -1)
+    {
+        free(p_ep->psz_path);
+        return VLC_ENOMEM;
+    }
+    i_ret = vlc_UrlParse(&p_ep->url, psz_url);
+    free(psz_url);
+
+    p_ep->b_tls = p_ep->url.psz_protocol == NULL
+               || strcasecmp(p_ep->url.psz_protocol, "http");
+    if (p_ep->b_tls && p_ep->url.psz_protocol != NULL
+     && strcasecmp(p_ep->url.psz_protocol, "https"))
+        i_ret = VLC_EGENERIC;
+
+    p_ep->psz_name = p_ep->psz_path ? p_ep->psz_path : p_ep->url.psz_host;
+    p_ep->psz_token = strdup(psz_token);
+    p_ep->p_interrupt = vlc_interrupt_create();
+    if (i_ret || EMPTY_STR(p_ep->psz_name) || !p_ep->psz_token
+     || !p_ep->p_interrupt
+     || (p_ep->p_sink != &p_sinks[SINK_HTTP] && p_ep->psz_path == NULL))
+    {
+        if (p_ep->p_interrupt)
+            vlc_interrupt_destroy(p_ep->p_interrupt);
+        vlc_UrlClean(&p_ep->url);
+        free(p_ep->psz_token);
+        free(p_ep->psz_path);
+        return VLC_EGENERIC;
+    }
+
+    if (!p_ep->b_tls && p_ep->psz_path == NULL)
+        msg_Warn(p_intf, "Submitting to %s without TLS", p_ep->psz_name);
+    /* a file has no token to check */
+    if (p_ep->p_sink == &p_sinks[SINK_FILE])
+        p_ep->i_token = TOKEN_VALID;
+
+    p_ep->i_batch_max = BATCH_INITIAL;
+    p_ep->i_slo = var_InheritInteger(p_intf, "listenbrainz-latency-slo")
+                * CLOCK_FREQ;
+    p_ep->limit.i_remaining = -1;
+    p_ep->p_intf = p_intf;
+#ifdef HAVE_ZLIB_H
+    p_ep->b_gzip = p_ep->p_sink != &p_sinks[SINK_FILE]
+                && var_InheritBool(p_intf, "listenbrainz-gzip");
+#endif
+    (*pi_eps)++;
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * AddHelper : register the helper to hand listens to, in place of servers
+ *****************************************************************************/
+static int AddHelper(intf_thread_t *p_intf, listenbrainz_endpoint_t **pp_eps,
+                     int *pi_eps, const char *psz_socket)
+{
+    listenbrainz_endpoint_t *p_ep = realloc(*pp_eps, sizeof(*p_ep));
+
+    if (!p_ep)
+        return VLC_ENOMEM;
+    *pp_eps = p_ep;
+    memset(p_ep, 0, sizeof(*p_ep));
+
+    p_ep->psz_socket = strdup(psz_socket);
+    p_ep->p_interrupt = vlc_interrupt_create();
+    if (!p_ep->psz_socket || !p_ep->p_interrupt)
+    {
+        if (p_ep->p_interrupt)
+            vlc_interrupt_destroy(p_ep->p_interrupt);
+        free(p_ep->psz_socket);
+        return VLC_ENOMEM;
+    }
+    p_ep->psz_name = p_ep->psz_socket;
+    p_ep->p_intf = p_intf;
+    *pi_eps = 1;
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * ParseEndpoints : read the main server and its mirrors from the settings
+ *****************************************************************************/
+static void ParseEndpoints(intf_thread_t *p_intf,
+                           listenbrainz_endpoint_t **pp_eps, int *pi_eps)
+{
+    /* a helper submits for this instance, unless this is the helper */
+    char *psz_helper = var_InheritString(p_intf, "listenbrainz-helper");
+    if (!EMPTY_STR(psz_helper) && p_intf->p_sys->psz_serve == NULL)
+    {
+        if (AddHelper(p_intf, pp_eps, pi_eps, psz_helper) != VLC_SUCCESS)
+            msg_Err(p_intf, "cannot hand listens to the helper");
+        free(psz_helper);
+        return;
+    }
+    free(psz_helper);
+
+    char *psz_token = var_InheritString(p_intf, "listenbrainz-usertoken");
+    char *psz_host = var_InheritString(p_intf, "submission-url");
+
+    if (EMPTY_STR(psz_token))
+        msg_Warn(p_intf, "No user token set, not submitting to %s",
+                 psz_host ? psz_host : "the main server");
+    else if (AddEndpoint(p_intf, pp_eps, pi_eps, psz_host ? psz_host : "",
+                         psz_token) != VLC_SUCCESS)
+        msg_Err(p_intf, "Invalid submission URL");
+    free(psz_host);
+    free(psz_token);
+
+    /* mirrors are given as comma separated token@host pairs */
+    char *psz_mirrors = var_InheritString(p_intf, "listenbrainz-mirrors");
+    if (psz_mirrors == NULL)
+        return;
+
+    char *psz_save;
+    for (char *psz_entry = strtok_r(psz_mirrors, ", ", &psz_save);
+         psz_entry != NULL; psz_entry = strtok_r(NULL, ", ", &psz_save))
+    {
+        char *psz_at = strrchr(psz_entry, '@');
+        if (psz_at == NULL || psz_at == psz_entry || psz_at[1] == '\0')
+        {
+            msg_Warn(p_intf, "Ignoring a mirror not of the form token@host");
+            continue;
+        }
+        *psz_at = '\0';
+        if (AddEndpoint(p_intf, pp_eps, pi_eps, psz_at + 1, psz_entry)
+                != VLC_SUCCESS)
+            msg_Warn(p_intf, "Ignoring invalid mirror %s", psz_at + 1);
+    }
+    free(psz_mirrors);
+}
+
+/*****************************************************************************
+ * DeleteEndpoints : release endpoints once their threads are joined
+ *****************************************************************************/
+static void DeleteEndpoints(listenbrainz_endpoint_t *p_eps, int i_eps)
+{
+    for (int i = 0; i < i_eps; i++)
+    {
+        listenbrainz_endpoint_t *p_ep = &p_eps[i];
+
+        if (p_ep->p_sink != NULL)
+            p_ep->p_sink->pf_close(p_ep);
+        if (p_ep->p_sock != NULL)
+            vlc_tls_Close(p_ep->p_sock);
+        if (p_ep->p_creds != NULL)
+            vlc_tls_Delete(p_ep->p_creds);
+        if (p_ep->b_deadline)
+            vlc_timer_destroy(p_ep->deadline);
+        vlc_interrupt_destroy(p_ep->p_interrupt);
+        vlc_UrlClean(&p_ep->url);
+        free(p_ep->psz_token);
+        free(p_ep->psz_path);
+        free(p_ep->psz_socket);
+    }
+    free(p_eps);
+}
+
+/*****************************************************************************
+ * JoinEndpoints : stop the submission threads of the first i_count endpoints
+ *****************************************************************************/
+static void JoinEndpoints(listenbrainz_endpoint_t *p_eps, int i_count)
+{
+    for (int i = 0; i < i_count; i++)
+    {
+        /* abort any pending network I/O, then the thread itself */
+        vlc_interrupt_kill(p_eps[i].p_interrupt);
+        vlc_cancel(p_eps[i].thread);
+    }
+    for (int i = 0; i < i_count; i++)
+        vlc_join(p_eps[i].thread, NULL);
+}
+
+/*****************************************************************************
+ * StartEndpoints : spawn one submission thread per endpoint
+ *****************************************************************************/
+static int StartEndpoints(listenbrainz_endpoint_t *p_eps, int i_eps)
+{
+    for (int i = 0; i < i_eps; i++)
+    {
+        /* without a timer, a late server holds its thread until Close */
+        if (p_eps[i].psz_socket == NULL)
+            p_eps[i].b_deadline = !vlc_timer_create(&p_eps[i].deadline,
+                                                    ExchangeLate, &p_eps[i]);
+        if (vlc_clone(&p_eps[i].thread, p_eps[i].psz_socket ? Handoff : Run,
+                      &p_eps[i], VLC_THREAD_PRIORITY_LOW))
+        {
+            JoinEndpoints(p_eps, i);
+            return VLC_ENOMEM;
+        }
+    }
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * SameEndpoint : if two endpoints submit to the same server and account, or
+ * hand listens to the same helper
+ *****************************************************************************/
+static bool SameEndpoint(const listenbrainz_endpoint_t *p_a,
+                         const listenbrainz_endpoint_t *p_b)
+{
+    if (p_a->psz_socket != NULL || p_b->psz_socket != NULL)
+        return p_a->psz_socket != NULL && p_b->psz_socket != NULL
+            && !strcmp(p_a->psz_socket, p_b->psz_socket);
+    return p_a->p_sink == p_b->p_sink
+        && !strcmp(p_a->psz_name, p_b->psz_name)
+        && p_a->url.i_port == p_b->url.i_port
+        && p_a->b_tls == p_b->b_tls
+        && !strcmp(p_a->psz_token, p_b->psz_token);
+}
+
+/*****************************************************************************
+ * Reconfigure : replace the endpoints by a new snapshot of the settings.
+ * Connections, backoffs and breakers start afresh; an endpoint which is still
+ * the same server and account keeps its position in the queue.
+ * Must be called with config_lock held.
+ *****************************************************************************/
+static int Reconfigure(intf_thread_t *p_intf)
+{
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_endpoint_t *p_eps = NULL, *p_old;
+    int                     i_eps = 0, i_old;
+
+    ParseEndpoints(p_intf, &p_eps, &i_eps);
+
+    /* only the instance holding the lock of the spool submits */
+    if (p_sys->psz_spool != NULL && !p_sys->b_leader)
+    {
+        DeleteEndpoints(p_eps, i_eps);
+        p_eps = NULL;
+        i_eps = 0;
+    }
+
+    /* the threads must not hold any listen while the endpoints change */
+    JoinEndpoints(p_sys->p_endpoints, p_sys->i_endpoints);
+
+    vlc_mutex_lock(&p_sys->lock);
+    p_old = p_sys->p_endpoints;
+    i_old = p_sys->i_endpoints;
+    for (int i = 0; i < i_eps; i++)
+    {
+        listenbrainz_endpoint_t *p_ep = &p_eps[i];
+
+        p_ep->i_next = p_sys->i_queue_base;
+        for (int j = 0; j < i_old; j++)
+            if (SameEndpoint(p_ep, &p_old[j]))
+            {
+                p_ep->i_next = p_old[j].i_next;
+                p_ep->i_token = p_old[j].i_token;
+            }
+    }
+    p_sys->p_endpoints = p_eps;
+    p_sys->i_endpoints = i_eps;
+    TrimQueue(p_sys);
+    vlc_mutex_unlock(&p_sys->lock);
+
+    DeleteEndpoints(p_old, i_old);
+
+    int i_ret = StartEndpoints(p_eps, i_eps);
+    if (i_ret != VLC_SUCCESS)
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        p_sys->p_endpoints = NULL;
+        p_sys->i_endpoints = 0;
+        vlc_mutex_unlock(&p_sys->lock);
+        DeleteEndpoints(p_eps, i_eps);
+    }
+    return i_ret;
+}
+
+/* Settings which apply while VLC runs: they are read again every
+ * SETTINGS_INTERVAL, and the endpoints are rebuilt when one of them changed,
+ * be it in the preferences or with vlc.config.set() from Lua. */
+static const struct
+{
+    const char  *psz_name;
+    int         i_type;
+} p_settings[] = {
+    { "listenbrainz-usertoken", VLC_VAR_STRING },
+    { "submission-url",         VLC_VAR_STRING },
+    { "listenbrainz-mirrors",   VLC_VAR_STRING },
+#ifdef HAVE_ZLIB_H
+    { "listenbrainz-gzip",      VLC_VAR_BOOL },
+#endif
+};
+
+/*****************************************************************************
+ * SettingsRead : the current values of the settings, NULL on error
+ *****************************************************************************/
+static char *SettingsRead(intf_thread_t *p_intf)
+{
+    struct vlc_memstream stream;
+
+    vlc_memstream_open(&stream);
+    for (size_t i = 0; i < ARRAY_SIZE(p_settings); i++)
+        if (p_settings[i].i_type == VLC_VAR_BOOL)
+            vlc_memstream_printf(&stream, "%s=%d\n", p_settings[i].psz_name,
+                                 var_InheritBool(p_intf, p_settings[i].psz_name));
+        else
+        {
+            char *psz_value = var_InheritString(p_intf, p_settings[i].psz_name);
+            vlc_memstream_printf(&stream, "%s=%s\n", p_settings[i].psz_name,
+                                 psz_value ? psz_value : "");
+            free(psz_value);
+        }
+    if (vlc_memstream_close(&stream))
+        return NULL;
+    return stream.ptr;
+}
+
+/*****************************************************************************
+ * SettingsTimer : rebuild the endpoints when the settings changed
+ *****************************************************************************/
+static void SettingsTimer(void *data)
+{
+    intf_thread_t   *p_intf = data;
+    intf_sys_t      *p_sys  = p_intf->p_sys;
+    char            *psz_settings = SettingsRead(p_intf);
+
+    if (psz_settings == NULL)
+        return;
+
+    vlc_mutex_lock(&p_sys->config_lock);
+    if (p_sys->psz_settings == NULL
+     || strcmp(psz_settings, p_sys->psz_settings))
+    {
+        msg_Dbg(p_intf, "The settings changed, reloading them");
+        free(p_sys->psz_settings);
+        p_sys->psz_settings = psz_settings;
+        psz_settings = NULL;
+        if (Reconfigure(p_intf) != VLC_SUCCESS)
+            msg_Err(p_intf, "cannot start the submission");
+    }
+    vlc_mutex_unlock(&p_sys->config_lock);
+    free(psz_settings);
+}
+
+/*****************************************************************************
+ * Open: initialize and create stuff
+ *****************************************************************************/
+static int Open(vlc_object_t *p_this)
+{
+    intf_thread_t   *p_intf     = (intf_thread_t*) p_this;
+    intf_sys_t      *p_sys      = calloc(1, sizeof(intf_sys_t));
+
+    if (!p_sys)
+        return VLC_ENOMEM;
+
+    p_intf->p_sys = p_sys;
+
+    vlc_mutex_init(&p_sys->lock);
+    vlc_mutex_init(&p_sys->config_lock);
+    vlc_mutex_init(&p_sys->trace_lock);
+    vlc_cond_init(&p_sys->wait);
+    vlc_cond_init(&p_sys->import_wait);
+    TraceOpen(p_intf);
+    JsonSelect();
+    RecordOpen(p_intf);
+    SpoolOpen(p_intf);
+    ServeOpen(p_intf);
+
+    p_sys->i_prefetch = var_InheritInteger(p_intf, "listenbrainz-prefetch");
+    MetaCacheOpen(p_intf, &p_sys->meta_cache);
+
+    for (int i = 0; i < METRIC_COUNT; i++)
+        var_Create(p_intf->obj.libvlc, p_metrics[i].psz_var, VLC_VAR_INTEGER);
+    for (int i = 0; i < LATENCY_COUNT; i++)
+        var_Create(p_intf->obj.libvlc, p_latencies[i].psz_var, VLC_VAR_STRING);
+
+    vlc_mutex_lock(&p_sys->config_lock);
+    p_sys->psz_settings = SettingsRead(p_intf);
+    int i_ret = Reconfigure(p_intf);
+    vlc_mutex_unlock(&p_sys->config_lock);
+    if (i_ret != VLC_SUCCESS)
+    {
+        free(p_sys->psz_settings);
+        for (int i = 0; i < METRIC_COUNT; i++)
+            var_Destroy(p_intf->obj.libvlc, p_metrics[i].psz_var);
+        for (int i = 0; i < LATENCY_COUNT; i++)
+            var_Destroy(p_intf->obj.libvlc, p_latencies[i].psz_var);
+        MetaCacheClose(&p_sys->meta_cache);
+        SpoolClose(p_sys);
+        ServeClose(p_sys);
+        TraceClose(p_sys);
+        RecordClose(p_sys);
+        vlc_cond_destroy(&p_sys->wait);
+        vlc_cond_destroy(&p_sys->import_wait);
+        vlc_mutex_destroy(&p_sys->trace_lock);
+        vlc_mutex_destroy(&p_sys->config_lock);
+        vlc_mutex_destroy(&p_sys->lock);
+        free(p_sys);
+        return i_ret;
+    }
+
+    /* listens are kept until a user token is set */
+    if (p_sys->i_endpoints == 0
+     && (p_sys->psz_spool == NULL || p_sys->b_leader))
+        vlc_dialog_display_error(p_intf,
+                                 "Listenbrainz usertoken not set",
+                                 "%s", "Please set a user token or disable the "
+                                         "ListenBrainz plugin.\n"
+                                         "Visit https://listenbrainz.org/profile/ to get a user token.");
+
+    p_sys->b_settings_timer = !vlc_timer_create(&p_sys->settings_timer,
+                                                SettingsTimer, p_intf);
+    if (p_sys->b_settings_timer)
+        vlc_timer_schedule(p_sys->settings_timer, false, SETTINGS_INTERVAL,
+                           SETTINGS_INTERVAL);
+
+    p_sys->psz_metrics_file = var_InheritString(p_intf, "listenbrainz-metrics-file");
+    if (p_sys->psz_metrics_file && (!*p_sys->psz_metrics_file
+     || vlc_timer_create(&p_sys->metrics_timer, MetricsTimer, p_intf)))
+        FREENULL(p_sys->psz_metrics_file);
+    if (p_sys->psz_metrics_file)
+    {
+        mtime_t i_interval = CLOCK_FREQ * var_InheritInteger(p_intf, "listenbrainz-metrics-interval");
+        vlc_timer_schedule(p_sys->metrics_timer, false, i_interval, i_interval);
+    }
+
+    if (p_sys->i_prefetch > 0 && vlc_timer_create(&p_sys->prefetch_timer,
+                                                  PrefetchTimer, p_intf))
+        p_sys->i_prefetch = 0;
+    var_AddCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+
+    p_sys->psz_import = var_InheritString(p_intf, "listenbrainz-import-file");
+    if (p_sys->psz_import && (!*p_sys->psz_import
+     || vlc_clone(&p_sys->import_thread, Import, p_intf,
+                  VLC_THREAD_PRIORITY_LOW)))
+        FREENULL(p_sys->psz_import);
+
+    if (p_sys->psz_spool && vlc_clone(&p_sys->spool_thread, Spool, p_intf,
+                                      VLC_THREAD_PRIORITY_LOW))
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        SpoolClose(p_sys);
+        vlc_mutex_unlock(&p_sys->lock);
+    }
+    if (p_sys->p_serve_interrupt
+     && vlc_clone(&p_sys->serve_thread, Serve, p_intf, VLC_THREAD_PRIORITY_LOW))
+        ServeClose(p_sys);
+
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * Close: destroy interface stuff
+ *****************************************************************************/
+static void Close(vlc_object_t *p_this)
+{
+    intf_thread_t               *p_intf = (intf_thread_t*) p_this;
+    intf_sys_t                  *p_sys  = p_intf->p_sys;
+
+    if (p_sys->b_settings_timer)
+        vlc_timer_destroy(p_sys->settings_timer);
+
+    /* the instances handing listens over keep them until a helper is back */
+    if (p_sys->p_serve_interrupt)
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        p_sys->b_serve_stop = true;
+        vlc_cond_broadcast(&p_sys->import_wait);
+        vlc_mutex_unlock(&p_sys->lock);
+        vlc_interrupt_kill(p_sys->p_serve_interrupt);
+        vlc_join(p_sys->serve_thread, NULL);
+    }
+    /* what was not delivered is left in the spool to the next instance */
+    if (p_sys->psz_spool)
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        p_sys->b_spool_stop = true;
+        vlc_cond_broadcast(&p_sys->import_wait);
+        vlc_mutex_unlock(&p_sys->lock);
+        vlc_join(p_sys->spool_thread, NULL);
+    }
+
+    /* the import checkpoints what the endpoints delivered until then */
+    if (p_sys->psz_import)
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        p_sys->b_import_stop = true;
+        vlc_cond_broadcast(&p_sys->import_wait);
+        vlc_mutex_unlock(&p_sys->lock);
+        vlc_join(p_sys->import_thread, NULL);
+        free(p_sys->psz_import);
+    }
+    JoinEndpoints(p_sys->p_endpoints, p_sys->i_endpoints);
+
+    if (p_sys->psz_metrics_file)
+    {
+        vlc_timer_destroy(p_sys->metrics_timer);
+        ExportMetrics(p_intf);      /* last values */
+        free(p_sys->psz_metrics_file);
+    }
+    for (int i = 0; i < METRIC_COUNT; i++)
+        var_Destroy(p_intf->obj.libvlc, p_metrics[i].psz_var);
+    for (int i = 0; i < LATENCY_COUNT; i++)
+        var_Destroy(p_intf->obj.libvlc, p_latencies[i].psz_var);
+
+    var_DelCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+    if (p_sys->i_prefetch > 0)
+        vlc_timer_destroy(p_sys->prefetch_timer);
+    libvlc_MetadataCancel(p_intf->obj.libvlc, p_intf);
+
+    if (p_sys->p_input != NULL)
+    {
+        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
+        vlc_object_release(p_sys->p_input);
+    }
+
+    int i;
+    for (i = 0; i < p_sys->i_songs; i++)
+        DeleteListen(p_sys, &p_sys->p_queue[i]);
+    free(p_sys->strings.pp_buckets);
+    DeleteSong(&p_sys->p_current_song);
+    free(p_sys->psz_stream_np);
+    free(p_sys->psz_stream_a);
+    free(p_sys->psz_stream_t);
+    DeleteEndpoints(p_sys->p_endpoints, p_sys->i_endpoints);
+    free(p_sys->psz_settings);
+    SpoolClose(p_sys);
+    ServeClose(p_sys);
+    MetaCacheClose(&p_sys->meta_cache);
+    TraceClose(p_sys);
+    RecordClose(p_sys);
+    vlc_cond_destroy(&p_sys->wait);
+    vlc_cond_destroy(&p_sys->import_wait);
+    vlc_mutex_destroy(&p_sys->trace_lock);
+    vlc_mutex_destroy(&p_sys->config_lock);
+    vlc_mutex_destroy(&p_sys->lock);
+    free(p_sys);
+}
+
+static void HandleInterval(mtime_t *next, unsigned int *i_interval)
+{
+    if (*i_interval == 0)
+    {
+        /* first interval is 1 minute */
+        *i_interval = 1;
+    }
+    else
+    {
+        /* else we double the previous interval, up to 120 minutes */
+        *i_interval <<= 1;
+        if (*i_interval > 120)
+            *i_interval = 120;
+    }
+    *next = ClockNow() + (*i_interval * 1000000 * 60);
+}
+
+/*****************************************************************************
+ * AdaptBatch : size the next batches after one of i_batch listens went
+ * through in i_rtt, AIMD-style: a full batch delivered in half of the latency
+ * target makes room for BATCH_STEP more listens, a slower one halves them
+ *****************************************************************************/
+static void AdaptBatch(listenbrainz_endpoint_t *p_ep, int i_batch,
+                       mtime_t i_rtt)
+{
+    if (i_rtt > __MAX(p_ep->i_slo / 2, BATCH_RTT_MIN) && i_batch > 1)
+        p_ep->i_batch_max = i_batch / 2;
+    else if (i_batch >= p_ep->i_batch_max)
+        p_ep->i_batch_max = __MIN(p_ep->i_batch_max + BATCH_STEP, BATCH_MAX);
+}
+
+/*****************************************************************************
+ * PaceRequests : with few requests left in the rate limit window of the
+ * server, spread them over the rest of the window rather than get a 429;
+ * the listens queued meanwhile make larger batches
+ *****************************************************************************/
+static void PaceRequests(listenbrainz_endpoint_t *p_ep)
+{
+    const listenbrainz_ratelimit_t *p_limit = &p_ep->limit;
+    mtime_t now = ClockNow();
+
+    if (p_limit->i_remaining < 0 || p_limit->i_remaining >= RATELIMIT_HEADROOM
+     || p_limit->reset <= now)
+        return;
+    mtime_t next = now + (p_limit->reset - now) / (p_limit->i_remaining + 1);
+    p_ep->next_exchange = __MAX(p_ep->next_exchange, next);
+}
+
+#ifdef HAVE_ZLIB_H
+/*****************************************************************************
+ * CompressPayload : gzip a request body through a streaming deflate stage
+ *****************************************************************************/
+static int CompressPayload(const struct vlc_memstream *p_in,
+                           struct vlc_memstream *p_out)
+{
+    unsigned char   p_chunk[16384];
+    z_stream        z;
+    int             i_ret;
+
+    memset(&z, 0, sizeof(z));
+    /* 15 window bits + 16 selects the gzip wrapper instead of zlib's */
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return VLC_EGENERIC;
+
+    vlc_memstream_open(p_out);
+
+    z.next_in = (unsigned char *) p_in->ptr;
+    z.avail_in = p_in->length;
+    do
+    {
+        z.next_out = p_chunk;
+        z.avail_out = sizeof(p_chunk);
+        i_ret = deflate(&z, Z_FINISH);
+        if (i_ret == Z_STREAM_ERROR)
+            break;
+        vlc_memstream_write(p_out, p_chunk, sizeof(p_chunk) - z.avail_out);
+    }
+    while (i_ret != Z_STREAM_END);
+
+    deflateEnd(&z);
+
+    if (vlc_memstream_close(p_out))
+        return VLC_ENOMEM;
+    if (i_ret != Z_STREAM_END)
+    {
+        free(p_out->ptr);
+        return VLC_EGENERIC;
+    }
+    return VLC_SUCCESS;
+}
+#endif
+
+/*****************************************************************************
+ * ParseStatus : extract the HTTP status code of a response, -1 if malformed
+ *****************************************************************************/
+static int ParseStatus(const char *psz_response)
+{
+    int i_status;
+
+    if (sscanf(psz_response, "HTTP/%*u.%*u %3d", &i_status) != 1)
+        return -1;
+    return i_status;
+}
+
+/*****************************************************************************
+ * ReadResponse : read a whole HTTP response, return its status or -1
+ *****************************************************************************/
+static int ReadResponse(intf_thread_t *p_intf, vlc_tls_t *p_sock,
+                        bool *pb_keep_alive, char *psz_body, size_t i_body,
+                        listenbrainz_ratelimit_t *p_limit)
+{
+    char        p_buffer[1024];
+    char        *psz_line;
+    int64_t     i_length = -1;
+    int         i_status;
+
+    *psz_body = '\0';
+    psz_line = vlc_tls_GetLine(p_sock);
+    if (psz_line == NULL)
+        return -1;
+    i_status = ParseStatus(psz_line);
+    free(psz_line);
+    if (i_status < 0)
+        return -1;
+
+    *pb_keep_alive = true;
+    p_limit->i_remaining = -1;
+    for (;;)
+    {
+        psz_line = vlc_tls_GetLine(p_sock);
+        if (psz_line == NULL)
+            return -1;
+        psz_line[strcspn(psz_line, "\r\n")] = '\0';
+        if (*psz_line == '\0')
+        {
+            free(psz_line);
+            break;
+        }
+
+        char *psz_value = strchr(psz_line, ':');
+        if (psz_value != NULL)
+        {
+            *psz_value++ = '\0';
+            psz_value += strspn(psz_value, " \t");
+            if (!strcasecmp(psz_line, "Content-Length"))
+                i_length = strtoll(psz_value, NULL, 10);
+            else if (!strcasecmp(psz_line, "Connection")
+                  && !strncasecmp(psz_value, "close", 5))
+                *pb_keep_alive = false;
+            else if (!strcasecmp(psz_line, "X-RateLimit-Remaining"))
+                p_limit->i_remaining = atoi(psz_value);
+            else if (!strcasecmp(psz_line, "X-RateLimit-Reset-In")
+                  || !strcasecmp(psz_line, "Retry-After"))
+                p_limit->reset = ClockNow() + atoi(psz_value) * CLOCK_FREQ;
+        }
+        free(psz_line);
+    }
+
+    /* Without a length (chunked or close delimited body), the connection
+     * cannot be reused */
+    if (i_length < 0)
+    {
+        *pb_keep_alive = false;
+        return i_status;
+    }
+
+    /* Drain the body, only keeping its beginning for the caller */
+    size_t i_kept = 0;
+    while (i_length > 0)
+    {
+        size_t i_want = __MIN((uint64_t) i_length, sizeof(p_buffer));
+        ssize_t i_read = vlc_tls_Read(p_sock, p_buffer, i_want, true);
+        if (i_read <= 0)
+        {
+            *pb_keep_alive = false;
+            break;
+        }
+        size_t i_copy = __MIN((size_t) i_read, i_body - 1 - i_kept);
+        memcpy(psz_body + i_kept, p_buffer, i_copy);
+        i_kept += i_copy;
+        i_length -= i_read;
+    }
+    psz_body[i_kept] = '\0';
+    if (i_status != 200 && i_kept > 0)
+        msg_Warn(p_intf, "Response %d: %s", i_status, psz_body);
+
+    return i_status;
+}
+
+/*****************************************************************************
+ * ConnectLocal : connect to a local socket, of the helper or of a proxy
+ *****************************************************************************/
+static vlc_tls_t *ConnectLocal(intf_thread_t *p_intf, const char *psz_path)
+{
+#ifndef _WIN32
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(psz_path) >= sizeof(addr.sun_path))
+        return NULL;
+    strcpy(addr.sun_path, psz_path);
+
+    int i_fd = vlc_socket(PF_LOCAL, SOCK_STREAM, 0, false);
+    if (i_fd == -1)
+        return NULL;
+    if (connect(i_fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        msg_Dbg(p_intf, "cannot connect to %s: %s", psz_path,
+                vlc_strerror_c(errno));
+        net_Close(i_fd);
+        return NULL;
+    }
+
+    vlc_tls_t *p_sock = vlc_tls_SocketOpen(i_fd);
+    if (p_sock == NULL)
+        net_Close(i_fd);
+    return p_sock;
+#else
+    VLC_UNUSED(p_intf);
+    VLC_UNUSED(psz_path);
+    return NULL;
+#endif
+}
+
+/*****************************************************************************
+ * SendRequest : send a request to an endpoint, return the response status or
+ * -1
+ *****************************************************************************/
+static int SendRequest(listenbrainz_endpoint_t *p_ep,
+                       const struct vlc_memstream *p_req,
+                       char *psz_body, size_t i_body)
+{
+    intf_thread_t *p_intf = p_ep->p_intf;
+    intf_sys_t    *p_sys = p_intf->p_sys;
+
+    for (;;)
+    {
+        bool b_reused = p_ep->p_sock != NULL;
+
+        if (!b_reused && p_ep->psz_path != NULL)
+        {
+            mtime_t i_start = mdate();
+            p_ep->p_sock = ConnectLocal(p_intf, p_ep->psz_path);
+            if (p_ep->p_sock == NULL)
+                return -1;
+            RecordLatency(p_sys, LATENCY_CONNECT, mdate() - i_start);
+        }
+        else if (!b_reused)
+        {
+            const struct addrinfo hints = {
+                .ai_socktype = SOCK_STREAM,
+                .ai_protocol = IPPROTO_TCP,
+            };
+            struct addrinfo *p_res;
+            vlc_tls_t *p_tcp = NULL;
+
+            msg_Dbg(p_intf, "Open socket to %s", p_ep->psz_name);
+            /* resolve, connect and handshake apart, to time them separately */
+            mtime_t i_start = mdate();
+            if (vlc_getaddrinfo_i11e(p_ep->url.psz_host,
+                                     p_ep->url.i_port ? p_ep->url.i_port
+                                         : p_ep->b_tls ? 443 : 80,
+                                     &hints, &p_res))
+                return -1;
+
+            mtime_t i_resolved = mdate();
+            TraceSpan(p_sys, "dns", i_start, i_resolved, p_ep->psz_name);
+
+            for (const struct addrinfo *p = p_res; p != NULL && p_tcp == NULL;
+                 p = p->ai_next)
+                p_tcp = vlc_tls_SocketOpenAddrInfo(p, false);
+            freeaddrinfo(p_res);
+            if (p_tcp == NULL)
+                return -1;
+
+            mtime_t i_connected = mdate();
+            RecordLatency(p_sys, LATENCY_CONNECT, i_connected - i_start);
+            TraceSpan(p_sys, "connect", i_resolved, i_connected,
+                      p_ep->psz_name);
+
+            if (!p_ep->b_tls)
+                p_ep->p_sock = p_tcp;
+            else
+            {
+                p_ep->p_sock = vlc_tls_ClientSessionCreate(p_ep->p_creds,
+                                    p_tcp, p_ep->url.psz_host, "https",
+                                    NULL, NULL);
+                if (p_ep->p_sock == NULL)
+                {
+                    vlc_tls_Close(p_tcp);
+                    return -1;
+                }
+                mtime_t i_handshaken = mdate();
+                RecordLatency(p_sys, LATENCY_HANDSHAKE,
+                              i_handshaken - i_connected);
+                TraceSpan(p_sys, "handshake", i_connected, i_handshaken,
+                          p_ep->psz_name);
+            }
+        }
+
+        mtime_t i_sent = mdate();
+        bool b_written = vlc_tls_Write(p_ep->p_sock, p_req->ptr, p_req->length)
+                            == (ssize_t) p_req->length;
+        mtime_t i_written = mdate();
+        TraceSpan(p_sys, "write", i_sent, i_written, p_ep->psz_name);
+        if (b_written)
+        {
+            bool b_keep_alive;
+            int i_status = ReadResponse(p_intf, p_ep->p_sock, &b_keep_alive,
+                                        psz_body, i_body, &p_ep->limit);
+            mtime_t i_read = mdate();
+            TraceSpan(p_sys, "read", i_written, i_read, p_ep->psz_name);
+            if (i_status > 0)
+            {
+                RecordLatency(p_sys, LATENCY_ROUNDTRIP, i_read - i_sent);
+                if (!b_keep_alive)
+                {
+                    vlc_tls_Close(p_ep->p_sock);
+                    p_ep->p_sock = NULL;
+                }
+                return i_status;
+            }
+        }
+
+        vlc_tls_Close(p_ep->p_sock);
+        p_ep->p_sock = NULL;
+
+        /* The server may have closed an idle kept-alive connection: try
+         * again once on a new connection, unless it was too late */
+        vlc_mutex_lock(&p_sys->lock);
+        bool b_late = p_ep->b_late;
+        vlc_mutex_unlock(&p_sys->lock);
+        if (!b_reused || b_late)
+            return -1;
+        CountMetric(p_sys, METRIC_RETRIES);
+    }
+}
+
+/*****************************************************************************
+ * ExchangeLate : deadline timer of an endpoint, interrupts its exchange until
+ * it ends
+ *****************************************************************************/
+static void ExchangeLate(void *data)
+{
+    listenbrainz_endpoint_t *p_ep = data;
+    intf_sys_t              *p_sys = p_ep->p_intf->p_sys;
+
+    vlc_mutex_lock(&p_sys->lock);
+    if (p_ep->b_armed)
+    {
+        p_ep->b_late = true;
+        vlc_interrupt_raise(p_ep->p_interrupt);
+    }
+    vlc_mutex_unlock(&p_sys->lock);
+}
+
+/*****************************************************************************
+ * Exchange : send a request to an endpoint, return the response status or -1.
+ * A server not done answering within EXCHANGE_TIMEOUT, e.g. trickling its
+ * response, is given up on as unreachable.
+ *****************************************************************************/
+static int Exchange(listenbrainz_endpoint_t *p_ep,
+                    const struct vlc_memstream *p_req,
+                    char *psz_body, size_t i_body)
+{
+    intf_sys_t  *p_sys = p_ep->p_intf->p_sys;
+    bool        b_late;
+
+    if (!p_ep->b_deadline)
+        return SendRequest(p_ep, p_req, psz_body, i_body);
+
+    vlc_mutex_lock(&p_sys->lock);
+    p_ep->b_armed = true;
+    p_ep->b_late = false;
+    vlc_mutex_unlock(&p_sys->lock);
+    vlc_timer_schedule(p_ep->deadline, false, EXCHANGE_TIMEOUT,
+                       EXCHANGE_REPEAT);
+
+    int i_status = SendRequest(p_ep, p_req, psz_body, i_body);
+
+    vlc_timer_schedule(p_ep->deadline, false, 0, 0);
+    vlc_mutex_lock(&p_sys->lock);
+    p_ep->b_armed = false;
+    b_late = p_ep->b_late;
+    vlc_mutex_unlock(&p_sys->lock);
+
+    if (b_late)
+    {
+        /* the interruption not seen yet must not abort the next exchange */
+        vlc_poll_i11e(NULL, 0, 0);
+        msg_Warn(p_ep->p_intf, "%s did not answer in time", p_ep->psz_name);
+        CloseHttp(p_ep);
+        return -1;
+    }
+    return i_status;
+}
+
+/*****************************************************************************
+ * JsonFind : locate the value of a key in a flat JSON object, or NULL
+ *****************************************************************************/
+static const char *JsonFind(const char *psz_json, const char *psz_key)
+{
+    size_t i_key = strlen(psz_key);
+
+    for (const char *psz = strchr(psz_json, '"'); psz != NULL;
+         psz = strchr(psz + 1, '"'))
+    {
+        if (strncmp(psz + 1, psz_key, i_key) || psz[i_key + 1] != '"')
+            continue;
+        psz += i_key + 2;
+        psz += strspn(psz, " \t\r\n");
+        if (*psz != ':')
+            continue;
+        psz++;
+        return psz + strspn(psz, " \t\r\n");
+    }
+    return NULL;
+}
+
+/*****************************************************************************
+ * PutHost : write the Host header of a request to an endpoint
+ *****************************************************************************/
+static void PutHost(struct vlc_memstream *p_req, const vlc_url_t *p_url)
+{
+    /* the port is only given when it is not the default one of the scheme */
+    if (p_url->i_port)
+        vlc_memstream_printf(p_req, "Host: %s:%u\r\n", p_url->psz_host,
+                             p_url->i_port);
+    else
+        vlc_memstream_printf(p_req, "Host: %s\r\n", p_url->psz_host);
+}
+
+/*****************************************************************************
+ * TokenRejected : pause an endpoint whose token the server refused
+ *****************************************************************************/
+static void TokenRejected(listenbrainz_endpoint_t *p_ep)
+{
+    intf_thread_t *p_intf = p_ep->p_intf;
+
+    p_ep->i_token = TOKEN_INVALID;
+    CountMetric(p_intf->p_sys, METRIC_FAILURES_AUTH);
+    msg_Err(p_intf, "%s rejected the user token, submission paused until "
+            "the token is changed", p_ep->psz_name);
+    vlc_dialog_display_error(p_intf,
+                             "Listenbrainz usertoken rejected",
+                             "%s rejected the user token. Listens will not be "
+                             "submitted to it until the token is changed.\n"
+                             "Visit https://listenbrainz.org/profile/ to get a user token.",
+                             p_ep->psz_name);
+}
+
+/*****************************************************************************
+ * ValidateToken : ask the endpoint whether its token is valid, and remember
+ * the verdict. Fails if the server could not tell.
+ *****************************************************************************/
+static int ValidateToken(listenbrainz_endpoint_t *p_ep)
+{
+    intf_thread_t           *p_intf = p_ep->p_intf;
+    struct vlc_memstream    req;
+    char                    p_body[1024];
+
+    /* the API sits under the path of the submission URL, whatever its
+     * prefix */
+    const char *psz_path = p_ep->url.psz_path;
+    size_t i_prefix = strlen(psz_path);
+    if (i_prefix >= strlen("submit-listens")
+     && !strcmp(psz_path + i_prefix - strlen("submit-listens"),
+                "submit-listens"))
+        i_prefix -= strlen("submit-listens");
+
+    vlc_memstream_open(&req);
+    vlc_memstream_printf(&req, "GET %.*svalidate-token HTTP/1.1\r\n",
+                         (int) i_prefix, psz_path);
+    PutHost(&req, &p_ep->url);
+    vlc_memstream_printf(&req, "Authorization: Token %s\r\n", p_ep->psz_token);
+    vlc_memstream_puts(&req, "User-Agent:"
+                             ""PACKAGE_NAME"/"PACKAGE_VERSION"\r\n");
+    vlc_memstream_puts(&req, "Accept-Encoding: identity\r\n");
+    vlc_memstream_puts(&req, "\r\n");
+    if (vlc_memstream_close(&req))
+        return VLC_ENOMEM;
+
+    mtime_t i_span = mdate();
+    int i_status = Exchange(p_ep, &req, p_body, sizeof(p_body));
+    free(req.ptr);
+    TraceSpan(p_intf->p_sys, "validate-token", i_span, mdate(),
+              p_ep->psz_name);
+
+    if (i_status == 401)
+    {
+        TokenRejected(p_ep);
+        return VLC_SUCCESS;
+    }
+    /* a compatible server may not implement the check: its submissions
+     * tell whether the token is right */
+    if (i_status == 404 || i_status == 405 || i_status == 501)
+    {
+        msg_Dbg(p_intf, "%s cannot validate tokens, submitting anyway",
+                p_ep->psz_name);
+        p_ep->i_token = TOKEN_VALID;
+        return VLC_SUCCESS;
+    }
+    if (i_status != 200)
+        return VLC_EGENERIC;
+
+    const char *psz_valid = JsonFind(p_body, "valid");
+    if (psz_valid == NULL)
+        return VLC_EGENERIC;
+    if (strncmp(psz_valid, "true", 4))
+    {
+        TokenRejected(p_ep);
+        return VLC_SUCCESS;
+    }
+
+    p_ep->i_token = TOKEN_VALID;
+    const char *psz_user = JsonFind(p_body, "user_name");
+    if (psz_user != NULL && *psz_user == '"')
+        msg_Dbg(p_intf, "Token of %.*s valid on %s",
+                (int) strcspn(psz_user + 1, "\""), psz_user + 1,
+                p_ep->psz_name);
+    else
+        msg_Dbg(p_intf, "Token valid on %s", p_ep->psz_name);
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * ForgePayload : join the listens serialized when queued into the body of a
+ * submission. Must be called with p_sys->lock held.
+ *****************************************************************************/
+static int ForgePayload(intf_sys_t *p_sys, uint64_t i_first, int i_batch,
+                        struct vlc_memstream *p_payload)
+{
+    vlc_memstream_open(p_payload);
+    vlc_memstream_printf(p_payload, "{\"listen_type\":\"%s\",\"payload\":[",
+                         i_batch == 1 ? "single" : "import");
+    for (int i = 0; i < i_batch; i++)
+    {
+        if (i > 0)
+            vlc_memstream_putc(p_payload, ',');
+        PutListen(p_payload, &p_sys->p_queue[i_first - p_sys->i_queue_base + i]);
+    }
+    vlc_memstream_puts(p_payload, "]}");
+    return vlc_memstream_close(p_payload);
+}
+
+/*****************************************************************************
+ * ForgeRequest : wrap a submission body into the HTTP request sending it
+ *****************************************************************************/
+static int ForgeRequest(const listenbrainz_endpoint_t *p_ep,
+                        const struct vlc_memstream *p_payload,
+                        bool b_compressed, struct vlc_memstream *p_req)
+{
+    vlc_memstream_open(p_req);
+    vlc_memstream_printf(p_req, "POST %s HTTP/1.1\r\n", p_ep->url.psz_path);
+    PutHost(p_req, &p_ep->url);
+    vlc_memstream_printf(p_req, "Authorization: Token %s\r\n", p_ep->psz_token);
+    vlc_memstream_puts(p_req, "User-Agent:"
+                              ""PACKAGE_NAME"/"PACKAGE_VERSION"\r\n");
+    vlc_memstream_puts(p_req, "Accept-Encoding: identity\r\n");
+    if (b_compressed)
+        vlc_memstream_puts(p_req, "Content-Encoding: gzip\r\n");
+    vlc_memstream_printf(p_req, "Content-Length: %zu\r\n", p_payload->length);
+    vlc_memstream_puts(p_req, "Content-Type: application/json\r\n");
+    vlc_memstream_puts(p_req, "\r\n");
+    /* Could avoid copying payload with iovec... but efforts */
+    vlc_memstream_write(p_req, p_payload->ptr, p_payload->length);
+
+    return vlc_memstream_close(p_req);
+}
+
+/*****************************************************************************
+ * SendHttp : submit a batch to the API of the endpoint
+ *****************************************************************************/
+static int SendHttp(listenbrainz_endpoint_t *p_ep,
+                    const struct vlc_memstream *p_payload, bool b_compressed,
+                    char *psz_body, size_t i_body)
+{
+    struct vlc_memstream req;
+
+    if (ForgeRequest(p_ep, p_payload, b_compressed, &req))
+        return -1;
+    int i_status = Exchange(p_ep, &req, psz_body, i_body);
+    free(req.ptr);
+    return i_status;
+}
+
+static void CloseHttp(listenbrainz_endpoint_t *p_ep)
+{
+    if (p_ep->p_sock != NULL)
+    {
+        vlc_tls_Close(p_ep->p_sock);
+        p_ep->p_sock = NULL;
+    }
+}
+
+/*****************************************************************************
+ * ForgeLines : join the listens serialized when queued into lines of JSON,
+ * as in the exports of ListenBrainz. Must be called with p_sys->lock held.
+ *****************************************************************************/
+static int ForgeLines(intf_sys_t *p_sys, uint64_t i_first, int i_batch,
+                      struct vlc_memstream *p_lines)
+{
+    vlc_memstream_open(p_lines);
+    for (int i = 0; i < i_batch; i++)
+    {
+        PutListen(p_lines, &p_sys->p_queue[i_first - p_sys->i_queue_base + i]);
+        vlc_memstream_putc(p_lines, '\n');
+    }
+    return vlc_memstream_close(p_lines);
+}
+
+/*****************************************************************************
+ * SendFile : append a batch to the file of the endpoint. The whole batch is
+ * synced at once, a single fsync() for all of its listens, and it is cut off
+ * again if it could not be written entirely, so the file only holds whole
+ * lines.
+ *****************************************************************************/
+static int SendFile(listenbrainz_endpoint_t *p_ep,
+                    const struct vlc_memstream *p_lines, bool b_compressed,
+                    char *psz_body, size_t i_body)
+{
+    intf_thread_t   *p_intf = p_ep->p_intf;
+    size_t          i_done = 0;
+    off_t           i_size = -1;
+
+    VLC_UNUSED(b_compressed);
+    VLC_UNUSED(i_body);
+    *psz_body = '\0';
+
+    if (p_ep->i_fd == -1)
+        p_ep->i_fd = vlc_open(p_ep->psz_path, O_WRONLY | O_CREAT | O_APPEND,
+                              0644);
+    if (p_ep->i_fd != -1)
+        i_size = lseek(p_ep->i_fd, 0, SEEK_END);
+    if (i_size == -1)
+    {
+        msg_Warn(p_intf, "cannot open %s: %s", p_ep->psz_path,
+                 vlc_strerror_c(errno));
+        CloseFile(p_ep);
+        return -1;
+    }
+
+    while (i_done < p_lines->length)
+    {
+        ssize_t i_written = write(p_ep->i_fd, p_lines->ptr + i_done,
+                                  p_lines->length - i_done);
+        if (i_written < 0 && errno != EINTR)
+            break;
+        if (i_written > 0)
+            i_done += i_written;
+    }
+    if (i_done < p_lines->length || fsync(p_ep->i_fd))
+    {
+        msg_Warn(p_intf, "cannot write %s: %s", p_ep->psz_path,
+                 vlc_strerror_c(errno));
+#ifndef _WIN32
+        if (ftruncate(p_ep->i_fd, i_size))
+#else
+        if (_chsize_s(p_ep->i_fd, i_size))
+#endif
+            msg_Err(p_intf, "%s is left with a partial batch", p_ep->psz_path);
+        CloseFile(p_ep);
+        return -1;
+    }
+    return 200;
+}
+
+static void CloseFile(listenbrainz_endpoint_t *p_ep)
+{
+    if (p_ep->i_fd != -1)
+    {
+        vlc_close(p_ep->i_fd);
+        p_ep->i_fd = -1;
+    }
+}
+
+/*****************************************************************************
+ * WaitListens : wait for listens the endpoint has to deliver, as a
+ * cancellation point. A listen queued while the endpoint was idle lingers for
+ * up to i_linger, for others to fill its batch. Returns whether the endpoint
+ * was idle. Must be called with p_sys->lock held.
+ *****************************************************************************/
+static bool WaitListens(listenbrainz_endpoint_t *p_ep, mtime_t i_linger)
+{
+    intf_sys_t  *p_sys = p_ep->p_intf->p_sys;
+    bool        b_idle = p_ep->i_token == TOKEN_INVALID
+                      || p_ep->i_next >= p_sys->i_queue_base + p_sys->i_songs;
+
+    mutex_cleanup_push(&p_sys->lock);
+
+    /* with a rejected token, wait for the settings to change, which
+     * restarts this thread */
+    while (p_ep->i_token == TOKEN_INVALID
+        || p_ep->i_next >= p_sys->i_queue_base + p_sys->i_songs)
+        vlc_cond_wait(&p_sys->wait, &p_sys->lock);
+
+    /* the listens queued meanwhile did not wait for the previous request,
+     * and a full queue does not wait either */
+    if (b_idle && i_linger > 0)
+    {
+        mtime_t deadline = mdate() + i_linger;
+        while (p_sys->i_queue_base + p_sys->i_songs - p_ep->i_next
+                    < (uint64_t) p_ep->i_batch_max
+            && p_sys->i_songs < QUEUE_MAX
+            && vlc_cond_timedwait(&p_sys->wait, &p_sys->lock,
+                                  deadline) == 0);
+    }
+
+    vlc_cleanup_pop();
+    return b_idle;
+}
+
+/*****************************************************************************
+ * Run : submit songs to one endpoint
+ *****************************************************************************/
+static void *Run(void *data)
+{
+    listenbrainz_endpoint_t *p_ep = data;
+    intf_thread_t           *p_intf = p_ep->p_intf;
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    int                     canc = vlc_savecancel();
+
+    vlc_interrupt_set(p_ep->p_interrupt);
+
+    if (p_ep->b_tls)
+    {
+        p_ep->p_creds = vlc_tls_ClientCreate(VLC_OBJECT(p_intf));
+        if (p_ep->p_creds == NULL)
+            goto out;
+    }
+
+    /* main loop */
+    for (;;)
+    {
+        PublishMetrics(p_intf);
+
+        vlc_restorecancel(canc);
+        ClockWait(p_ep->next_exchange);
+        canc = vlc_savecancel();
+
+        /* check the token once, before anything is submitted with it */
+        if (p_ep->i_token == TOKEN_UNKNOWN)
+        {
+            if (ValidateToken(p_ep) != VLC_SUCCESS)
+            {
+                msg_Warn(p_intf, "Could not validate the token on %s",
+                         p_ep->psz_name);
+                HandleInterval(&p_ep->next_exchange, &p_ep->i_interval);
+                continue;
+            }
+            p_ep->i_interval = 0;
+            p_ep->next_exchange = VLC_TICK_INVALID;
+        }
+        vlc_restorecancel(canc);
+
+        /* a listen queued while idle lingers for others to fill its batch,
+         * as long as it is still delivered within the latency target */
+        mtime_t linger = p_ep->i_failures < BREAKER_THRESHOLD
+                        ? p_ep->i_slo - p_ep->i_rtt : 0;
+        vlc_mutex_lock(&p_sys->lock);
+        bool b_idle = WaitListens(p_ep, linger);
+        canc = vlc_savecancel();
+
+        msg_Dbg(p_intf, "Going to submit some data to %s...", p_ep->psz_name);
+        struct vlc_memstream payload;
+        bool b_compressed = false;
+        mtime_t i_span = mdate();
+
+        /* forge the payload from the listens serialized when queued */
+        uint64_t i_first = p_ep->i_next;
+        int i_batch = p_sys->i_queue_base + p_sys->i_songs - i_first;
+        i_batch = __MIN(i_batch, p_ep->i_batch_max);
+        /* while the breaker is open, probe the server with a single listen */
+        if (p_ep->i_failures >= BREAKER_THRESHOLD)
+            i_batch = 1;
+
+        int i_ret = p_ep->p_sink->pf_forge(p_sys, i_first, i_batch, &payload);
+        vlc_mutex_unlock(&p_sys->lock);
+        TraceSpan(p_sys, "payload", i_span, mdate(), p_ep->psz_name);
+
+        /* the metrics are published here rather than where the listens are
+         * queued, to keep the variables off the playback callbacks */
+        if (b_idle)
+            PublishMetrics(p_intf);
+
+        if (i_ret)
+            goto out;
+
+#ifdef HAVE_ZLIB_H
+        struct vlc_memstream gz;
+        mtime_t i_gzip = mdate();
+        if (p_ep->b_gzip && payload.length >= GZIP_MIN_SIZE
+         && CompressPayload(&payload, &gz) == VLC_SUCCESS)
+        {
+            TraceSpan(p_sys, "gzip", i_gzip, mdate(), p_ep->psz_name);
+            if (gz.length < payload.length)
+            {
+                msg_Dbg(p_intf, "Batch of %d listens: %zu bytes gzipped to %zu, "
+                        "%zu bytes saved", i_batch, payload.length, gz.length,
+                        payload.length - gz.length);
+                free(payload.ptr);
+                payload = gz;
+                b_compressed = true;
+            }
+            else
+                free(gz.ptr);
+        }
+#endif
+
+        char p_body[1024];
+        mtime_t i_exchange = mdate();
+        int i_status = p_ep->p_sink->pf_send(p_ep, &payload, b_compressed,
+                                             p_body, sizeof(p_body));
+        size_t i_bytes = payload.length;
+        free(payload.ptr);
+        mtime_t i_done = mdate();
+        TraceSpan(p_sys, "exchange", i_exchange, i_done, p_ep->psz_name);
+        TraceSpan(p_sys, "submit", i_span, i_done, p_ep->psz_name);
+        /* smoothed as TCP does, from a first sample taken as is */
+        if (i_status > 0 && p_ep->i_rtt == 0)
+            p_ep->i_rtt = i_done - i_exchange;
+        else if (i_status > 0)
+            p_ep->i_rtt += (i_done - i_exchange - p_ep->i_rtt) / 8;
+
+#ifdef HAVE_ZLIB_H
+        if (b_compressed && (i_status == 415
+         || (i_status == 400 && (strcasestr(p_body, "gzip") != NULL
+                              || strcasestr(p_body, "encoding") != NULL))))
+        {
+            /* The server does not understand compressed bodies: resend the
+             * same batch uncompressed right away, and stop compressing. Any
+             * other 400 is about the listens, not about their encoding. */
+            msg_Warn(p_intf, "Compressed submission refused (HTTP %d), "
+                     "falling back to identity encoding", i_status);
+            p_ep->b_gzip = false;
+            CountMetric(p_sys, METRIC_RETRIES);
+            continue;
+        }
+#endif
+
+        /* A batch too large for the server: resend half of it right away.
+         * A single listen refused fails as any other request. */
+        if ((i_status == 400 || i_status == 413) && i_batch > 1)
+        {
+            msg_Warn(p_intf, "Batch of %d listens refused by %s (HTTP %d), "
+                     "halving it", i_batch, p_ep->psz_name, i_status);
+            p_ep->i_batch_max = i_batch / 2;
+            CountMetric(p_sys, METRIC_BATCH_SPLITS);
+            continue;
+        }
+
+        if (i_status == 200)
+        {
+            vlc_mutex_lock(&p_sys->lock);
+            p_ep->i_next = __MAX(p_ep->i_next, i_first + i_batch);
+            TrimQueue(p_sys);
+            p_sys->pi_metrics[METRIC_SUBMITS]++;
+            p_sys->pi_metrics[METRIC_LISTENS] += i_batch;
+            p_sys->pi_metrics[p_ep->p_sink->i_listens] += i_batch;
+            p_sys->pi_metrics[p_ep->p_sink->i_bytes] += i_bytes;
+            bool b_pending = p_ep->i_next < p_sys->i_queue_base + p_sys->i_songs;
+            vlc_mutex_unlock(&p_sys->lock);
+
+            /* only keep the connection, or the file, open to drain a
+             * backlog */
+            if (!b_pending)
+                p_ep->p_sink->pf_close(p_ep);
+
+            if (p_ep->i_failures >= BREAKER_THRESHOLD)
+                msg_Info(p_intf, "%s is reachable again", p_ep->psz_name);
+            p_ep->i_failures = 0;
+            p_ep->i_interval = 0;
+            p_ep->next_exchange = VLC_TICK_INVALID;
+            AdaptBatch(p_ep, i_batch, i_done - i_exchange);
+            PaceRequests(p_ep);
+            msg_Dbg(p_intf, "Submission of %d listens to %s successful!",
+                    i_batch, p_ep->psz_name);
+        }
+        else if (i_status == 401)
+            TokenRejected(p_ep);
+        else if (i_status == 429)
+        {
+            /* the server is fine, only busy: wait for its rate limit window
+             * to start over, or back off if it did not tell when */
+            msg_Warn(p_intf, "Rate limited by %s", p_ep->psz_name);
+            CountMetric(p_sys, METRIC_RATE_LIMITED);
+            p_ep->limit.i_remaining = 0;
+            PaceRequests(p_ep);
+            if (p_ep->next_exchange <= ClockNow())
+                HandleInterval(&p_ep->next_exchange, &p_ep->i_interval);
+        }
+        else if (i_status >= 400 && i_status < 500 && i_batch == 1)
+        {
+            /* The server refuses this very listen, e.g. a malformed one from
+             * an import, the ingest socket or a spool: retrying it would
+             * hold back the queue of the endpoint for good. */
+            vlc_mutex_lock(&p_sys->lock);
+            /* unless a full queue dropped it for this endpoint meanwhile */
+            if (p_ep->i_next == i_first)
+            {
+                const listenbrainz_listen_t *p_listen =
+                    &p_sys->p_queue[i_first - p_sys->i_queue_base];
+                msg_Warn(p_intf, "Dropping the listen %s - %s refused by %s "
+                         "(HTTP %d)", p_listen->p_a->psz_json,
+                         p_listen->p_t->psz_json, p_ep->psz_name, i_status);
+                p_ep->i_next++;
+                TrimQueue(p_sys);
+                p_sys->pi_metrics[METRIC_DROPS]++;
+            }
+            p_sys->pi_metrics[METRIC_FAILURES_CLIENT]++;
+            vlc_mutex_unlock(&p_sys->lock);
+
+            /* the server answered: it is reachable */
+            p_ep->i_failures = 0;
+            p_ep->i_interval = 0;
+            p_ep->next_exchange = VLC_TICK_INVALID;
+        }
+        else
+        {
+            if (i_status < 0)
+            {
+                msg_Warn(p_intf, "No response from %s", p_ep->psz_name);
+                CountMetric(p_sys, METRIC_FAILURES_NETWORK);
+            }
+            else if (i_status >= 400 && i_status < 500)
+                CountMetric(p_sys, METRIC_FAILURES_CLIENT);
+            else
+                CountMetric(p_sys, METRIC_FAILURES_SERVER);
+            if (++p_ep->i_failures == BREAKER_THRESHOLD)
+                msg_Warn(p_intf, "%s keeps failing, only probing it from now on",
+                         p_ep->psz_name);
+            HandleInterval(&p_ep->next_exchange, &p_ep->i_interval);
+        }
+    }
+    out:
+    vlc_restorecancel(canc);
+    return NULL;
+}
+
+/*****************************************************************************
+ * CheckpointPath : path of a file recording the progress of an import
+ *****************************************************************************/
+static char *CheckpointPath(const char *psz_name)
+{
+    char *psz_file;
+    char *psz_dir = config_GetUserDir(VLC_USERDATA_DIR);
+
+    if (psz_dir == NULL)
+        return NULL;
+    vlc_mkdir(psz_dir, 0700);
+    if (asprintf(&psz_file, "%s" DIR_SEP "%s", psz_dir, psz_name) == -1)
+        psz_file = NULL;
+    free(psz_dir);
+    return psz_file;
+}
+
+/*****************************************************************************
+ * ImportResume : offset to resume the import at, 0 unless the checkpoint was
+ * left by an import of the same file
+ *****************************************************************************/
+static int64_t ImportResume(listenbrainz_import_t *p_import, const char *psz_path)
+{
+    int64_t     i_offset = 0;
+    uint64_t    i_id;
+
+    if (p_import->psz_checkpoint == NULL)
+        return 0;
+    FILE *p_file = vlc_fopen(p_import->psz_checkpoint, "rt");
+    if (p_file == NULL)
+        return 0;
+
+    /* the offset and the identity of the file, then its path */
+    if (fscanf(p_file, "%"SCNd64" %"SCNx64"\n", &i_offset, &i_id) != 2
+     || fgets(p_import->psz_line, IMPORT_LINE_MAX, p_file) == NULL)
+        i_offset = 0;
+    else
+    {
+        p_import->psz_line[strcspn(p_import->psz_line, "\n")] = '\0';
+        if (i_id != p_import->i_id || strcmp(p_import->psz_line, psz_path))
+            i_offset = 0;
+    }
+    fclose(p_file);
+    return __MAX(i_offset, 0);
+}
+
+/*****************************************************************************
+ * ImportCheckpoint : record that the file is delivered up to i_offset
+ *****************************************************************************/
+static void ImportCheckpoint(intf_thread_t *p_intf,
+                             listenbrainz_import_t *p_import, int64_t i_offset)
+{
+    char *psz_tmp;
+
+    /* a failed write is tried again on the next progress only */
+    p_import->i_saved = i_offset;
+    p_import->i_save_date = mdate();
+    if (p_import->psz_checkpoint == NULL)
+        return;
+
+    /* write aside then rename, so that an interruption leaves a whole file */
+    if (asprintf(&psz_tmp, "%s.tmp", p_import->psz_checkpoint) == -1)
+        return;
+
+    FILE *p_file = vlc_fopen(psz_tmp, "wt");
+    if (p_file == NULL)
+    {
+        msg_Warn(p_intf, "cannot write %s: %s", psz_tmp, vlc_strerror_c(errno));
+        free(psz_tmp);
+        return;
+    }
+
+    fprintf(p_file, "%"PRId64" %016"PRIx64"\n%s\n", i_offset, p_import->i_id,
+            p_intf->p_sys->psz_import);
+
+    bool b_error = ferror(p_file);
+    if (fclose(p_file))
+        b_error = true;
+    if (b_error || vlc_rename(psz_tmp, p_import->psz_checkpoint))
+    {
+        msg_Warn(p_intf, "cannot write %s", p_import->psz_checkpoint);
+        vlc_unlink(psz_tmp);
+    }
+    free(psz_tmp);
+}
+
+/*****************************************************************************
+ * ImportReadLine : read the next line of the file, without its end, false at
+ * the end of the file. Lines too long for the buffer are skipped to their
+ * end and reported truncated.
+ *****************************************************************************/
+static bool ImportReadLine(listenbrainz_import_t *p_import, bool *pb_truncated)
+{
+    char    *psz_line = p_import->psz_line;
+    size_t  i_len;
+
+    if (fgets(psz_line, IMPORT_LINE_MAX, p_import->p_file) == NULL)
+        return false;
+
+    i_len = strlen(psz_line);
+    *pb_truncated = i_len == IMPORT_LINE_MAX - 1 && psz_line[i_len - 1] != '\n';
+    if (*pb_truncated)
+    {
+        int c;
+        while ((c = getc(p_import->p_file)) != EOF && c != '\n')
+            ;
+    }
+
+    while (i_len > 0 && (psz_line[i_len - 1] == '\n' || psz_line[i_len - 1] == '\r'))
+        psz_line[--i_len] = '\0';
+    return true;
+}
+
+/* Value of 4 hexadecimal digits, -1 if they are not */
+static int JsonHex(const char *psz)
+{
+    int i_value = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        int c = psz[i];
+
+        if (c >= '0' && c <= '9')
+            c -= '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            c = (c | 0x20) - 'a' + 10;
+        else
+            return -1;
+        i_value = (i_value << 4) | c;
+    }
+    return i_value;
+}
+
+/*****************************************************************************
+ * JsonString : decode in place the JSON string value at psz, returned as a
+ * C string, or NULL if it is not a string. Lone UTF-16 surrogates are
+ * replaced by U+FFFD.
+ *****************************************************************************/
+static char *JsonString(char *psz)
+{
+    char *psz_value = psz, *psz_out = psz;
+
+    /* escapes decode to fewer bytes than they take */
+    if (psz == NULL || *psz++ != '"')
+        return NULL;
+    while (*psz != '"')
+    {
+        if (*psz == '\0')
+            return NULL;
+        if (*psz != '\\')
+        {
+            *psz_out++ = *psz++;
+            continue;
+        }
+
+        int i_code;
+        switch (psz[1])
+        {
+            case '"': case '\\': case '/':
+                *psz_out++ = psz[1];
+                break;
+            case 'b': *psz_out++ = '\b'; break;
+            case 'f': *psz_out++ = '\f'; break;
+            case 'n': *psz_out++ = '\n'; break;
+            case 'r': *psz_out++ = '\r'; break;
+            case 't': *psz_out++ = '\t'; break;
+            case 'u':
+                i_code = JsonHex(psz + 2);
+                if (i_code < 0)
+                    return NULL;
+                psz += 4;
+                if (i_code >= 0xd800 && i_code < 0xdc00
+                 && psz[2] == '\\' && psz[3] == 'u')
+                {
+                    int i_low = JsonHex(psz + 4);
+                    if (i_low >= 0xdc00 && i_low < 0xe000)
+                    {
+                        i_code = 0x10000 + ((i_code - 0xd800) << 10)
+                               + (i_low - 0xdc00);
+                        psz += 6;
+                    }
+                }
+                if (i_code >= 0xd800 && i_code < 0xe000)
+                    i_code = 0xfffd;
+
+                if (i_code < 0x80)
+                    *psz_out++ = i_code;
+                else
+                {
+                    if (i_code < 0x800)
+                        *psz_out++ = 0xc0 | (i_code >> 6);
+                    else
+                    {
+                        if (i_code < 0x10000)
+                            *psz_out++ = 0xe0 | (i_code >> 12);
+                        else
+                        {
+                            *psz_out++ = 0xf0 | (i_code >> 18);
+                            *psz_out++ = 0x80 | ((i_code >> 12) & 0x3f);
+                        }
+                        *psz_out++ = 0x80 | ((i_code >> 6) & 0x3f);
+                    }
+                    *psz_out++ = 0x80 | (i_code & 0x3f);
+                }
+                break;
+            default:
+                return NULL;
+        }
+        psz += 2;
+    }
+    *psz_out = '\0';
+    return psz_value;
+}
+
+/*****************************************************************************
+ * ImportSong : make a song of a listen of the history, false if ListenBrainz
+ * would not take it
+ *****************************************************************************/
+static bool ImportSong(listenbrainz_song_t *p_song, const char *psz_a,
+                       const char *psz_t, const char *psz_b, const char *psz_m,
+                       int64_t i_date)
+{
+    time_t now;
+
+    /* a day ahead is left to the clocks of the devices which scrobbled */
+    ClockTime(&now);
+    if (psz_a == NULL || !*psz_a || psz_t == NULL || !*psz_t
+     || i_date < IMPORT_MIN_DATE || i_date > now + 86400)
+        return false;
+
+    p_song->date = i_date;
+    p_song->psz_a = vlc_uri_encode(psz_a);
+    p_song->psz_t = vlc_uri_encode(psz_t);
+    if (psz_b != NULL && *psz_b)
+        p_song->psz_b = vlc_uri_encode(psz_b);
+    /* the server refuses a listen with a malformed MBID, keep it without */
+    if (psz_m != NULL && strlen(psz_m) == 36
+     && strspn(psz_m, "0123456789abcdef-") == 36)
+        p_song->psz_m = vlc_uri_encode(psz_m);
+
+    if (!p_song->psz_a || !p_song->psz_t)
+    {
+        DeleteSong(p_song);
+        return false;
+    }
+    return true;
+}
+
+/*****************************************************************************
+ * ImportScrobble : parse a line of an Audioscrobbler scrobble log, i.e. the
+ * artist, album, title, track number, length, rating, timestamp and
+ * MusicBrainz track id, tab separated. Skipped tracks are not listens.
+ *****************************************************************************/
+static bool ImportScrobble(char *psz_line, bool b_local,
+                           listenbrainz_song_t *p_song)
+{
+    char    *ppsz_fields[8] = { NULL };
+    int     i_fields = 0;
+    char    *psz_end;
+
+    for (char *psz = psz_line; psz != NULL && i_fields < 8; i_fields++)
+    {
+        ppsz_fields[i_fields] = psz;
+        psz = strchr(psz, '\t');
+        if (psz != NULL)
+            *psz++ = '\0';
+    }
+    if (i_fields < 7 || strcmp(ppsz_fields[5], "L"))
+        return false;
+
+    int64_t i_date = strtoll(ppsz_fields[6], &psz_end, 10);
+    if (psz_end == ppsz_fields[6] || *psz_end)
+        return false;
+
+    /* timestamps of local time, e.g. of players without a time zone */
+    if (b_local)
+    {
+        time_t date = i_date;
+        struct tm tm;
+
+        if (gmtime_r(&date, &tm) != NULL)
+        {
+            tm.tm_isdst = -1;
+            i_date = mktime(&tm);
+        }
+    }
+
+    return ImportSong(p_song, ppsz_fields[0], ppsz_fields[2], ppsz_fields[1],
+                      ppsz_fields[7], i_date);
+}
+
+/*****************************************************************************
+ * ImportJson : parse a line of a JSON Lines export of ListenBrainz, i.e. a
+ * listen object
+ *****************************************************************************/
+static bool ImportJson(char *psz_line, listenbrainz_song_t *p_song)
+{
+    const char  *psz_date = JsonFind(psz_line, "listened_at");
+    const char  *psz_meta = JsonFind(psz_line, "track_metadata");
+    char        *psz_end;
+
+    if (psz_date == NULL || psz_meta == NULL)
+        return false;
+    int64_t i_date = strtoll(psz_date, &psz_end, 10);
+    if (psz_end == psz_date)
+        return false;
+
+    /* find all the values before decoding any of them in place */
+    char *psz_a = (char *) JsonFind(psz_meta, "artist_name");
+    char *psz_t = (char *) JsonFind(psz_meta, "track_name");
+    char *psz_b = (char *) JsonFind(psz_meta, "release_name");
+    char *psz_m = (char *) JsonFind(psz_meta, "recording_mbid");
+
+    psz_a = JsonString(psz_a);
+    psz_t = JsonString(psz_t);
+    psz_b = JsonString(psz_b);
+    psz_m = JsonString(psz_m);
+    return ImportSong(p_song, psz_a, psz_t, psz_b, psz_m, i_date);
+}
+
+/*****************************************************************************
+ * ImportWait : wait until the queue is down to i_max listens, saving the
+ * checkpoint as the import gets delivered. Must be called with p_sys->lock
+ * held. Returns false when the import is stopped.
+ *****************************************************************************/
+static bool ImportWait(intf_thread_t *p_intf, listenbrainz_import_t *p_import,
+                       int i_max)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+
+    for (;;)
+    {
+        if (p_sys->pi_delivered[LISTEN_IMPORT] != p_import->i_saved
+         && (p_sys->b_import_stop
+          || mdate() >= p_import->i_save_date + IMPORT_SAVE_INTERVAL))
+        {
+            int64_t i_done = p_sys->pi_delivered[LISTEN_IMPORT];
+
+            vlc_mutex_unlock(&p_sys->lock);
+            ImportCheckpoint(p_intf, p_import, i_done);
+            vlc_mutex_lock(&p_sys->lock);
+        }
+        else if (p_sys->b_import_stop)
+            return false;
+        else if (p_sys->i_songs <= i_max)
+            return true;
+        else
+            vlc_cond_wait(&p_sys->import_wait, &p_sys->lock);
+    }
+}
+
+/*****************************************************************************
+ * Import : stream the listen history file into the queue, which the endpoints
+ * submit in batches as they do the listens played. The file is read a line
+ * at a time and only so many of its listens wait in the queue, so the memory
+ * used does not depend on its size.
+ *****************************************************************************/
+static void *Import(void *data)
+{
+    intf_thread_t           *p_intf = data;
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_import_t   *p_import = malloc(sizeof(*p_import));
+    unsigned                i_queued = 0, i_rejected = 0, i_duplicates = 0;
+    int64_t                 i_offset;
+    bool                    b_truncated, b_stopped = false;
+
+    if (p_import == NULL)
+        return NULL;
+    p_import->p_file = vlc_fopen(p_sys->psz_import, "rb");
+    if (p_import->p_file == NULL)
+    {
+        msg_Err(p_intf, "cannot read %s: %s", p_sys->psz_import,
+                vlc_strerror_c(errno));
+        free(p_import);
+        return NULL;
+    }
+    p_import->psz_checkpoint = CheckpointPath("listenbrainz-import.checkpoint");
+    p_import->i_save_date = VLC_TICK_INVALID;
+    p_import->b_local = false;
+    p_import->psz_line[0] = '\0';
+
+    /* the file is known by its first line; the header of a scrobble log
+     * tells if its timestamps are in local time */
+    p_import->i_id = FNV1A_INIT;
+    if (ImportReadLine(p_import, &b_truncated))
+        p_import->i_id = Fnv1a(p_import->i_id, p_import->psz_line,
+                               strlen(p_import->psz_line));
+    while (p_import->psz_line[0] == '#')
+    {
+        if (!strcmp(p_import->psz_line, "#TZ/UNKNOWN"))
+            p_import->b_local = true;
+        if (!ImportReadLine(p_import, &b_truncated))
+            break;
+    }
+
+    i_offset = ImportResume(p_import, p_sys->psz_import);
+    if (fseeko(p_import->p_file, i_offset, SEEK_SET))
+    {
+        msg_Err(p_intf, "cannot seek %s: %s", p_sys->psz_import,
+                vlc_strerror_c(errno));
+        goto end;
+    }
+    if (i_offset > 0)
+        msg_Info(p_intf, "Resuming the import of %s at byte %"PRId64,
+                 p_sys->psz_import, i_offset);
 
-            msg_Dbg(p_intf, "Pause duration: %"PRIu64, (time_paused / 1000000));
-            //check whether duration of pause is more than 60s
-            if ((time_paused / 1000000) > 60) {
-                int64_t played_time = current_time - p_sys->p_current_song.i_start - p_sys->time_total_pauses;
-                played_time /= 1000000;
-                //check whether the item as of now qualifies as a listen
-                if ((played_time > 30) &&
-                    (played_time > 240 || played_time >= p_sys->p_current_song.i_l / 2)) {
-                    AddToQueue(p_intf);
-                    ReadMetaData(p_intf, p_input);
-                    p_sys->p_current_song.i_start = current_time;
-                    time(&p_sys->p_current_song.date);
-                    p_sys->time_total_pauses = 0;
-                }
-            }
-            p_sys->time_pause = 0;
+    vlc_mutex_lock(&p_sys->lock);
+    p_sys->pi_delivered[LISTEN_IMPORT] = p_import->i_saved = i_offset;
+    vlc_mutex_unlock(&p_sys->lock);
+
+    while (ImportReadLine(p_import, &b_truncated))
+    {
+        char                *psz_line = p_import->psz_line;
+        listenbrainz_song_t song = { 0 };
+
+        i_offset = ftello(p_import->p_file);
+        /* comments, e.g. the header of a scrobble log */
+        if (*psz_line == '#' || *psz_line == '\0')
+            continue;
+        if (b_truncated || !(*psz_line == '{'
+                ? ImportJson(psz_line, &song)
+                : ImportScrobble(psz_line, p_import->b_local, &song)))
+        {
+            i_rejected++;
+            continue;
+        }
+
+        uint64_t i_hash = HashListen(&song);
+        vlc_mutex_lock(&p_sys->lock);
+        if (!DedupInsert(&p_sys->dedup, i_hash))
+            i_duplicates++;
+        /* leave the rest of the queue to the songs played meanwhile */
+        else if ((b_stopped = !ImportWait(p_intf, p_import,
+                                          IMPORT_QUEUE_MAX - 1))
+              || QueueListen(p_sys, &song,
+                             &p_sys->p_queue[p_sys->i_songs]) != VLC_SUCCESS)
+            DedupRemove(&p_sys->dedup, i_hash);
+        else
+        {
+            listenbrainz_listen_t *p_listen = &p_sys->p_queue[p_sys->i_songs++];
+            p_listen->i_source = LISTEN_IMPORT;
+            p_listen->i_offset = i_offset;
+            p_sys->pi_metrics[METRIC_IMPORTS]++;
+            i_queued++;
+            vlc_cond_broadcast(&p_sys->wait);
         }
+        vlc_mutex_unlock(&p_sys->lock);
+        DeleteSong(&song);
+
+        if (b_stopped)
+            break;
     }
 
-    return VLC_SUCCESS;
+    if (!b_stopped && ferror(p_import->p_file))
+        msg_Err(p_intf, "cannot read %s", p_sys->psz_import);
+    else if (!b_stopped)
+    {
+        /* the whole file is done once its last listens are delivered */
+        vlc_mutex_lock(&p_sys->lock);
+        b_stopped = !ImportWait(p_intf, p_import, 0);
+        vlc_mutex_unlock(&p_sys->lock);
+        if (!b_stopped)
+        {
+            ImportCheckpoint(p_intf, p_import, i_offset);
+            msg_Info(p_intf, "Imported %s: %u listens, %u rejected, "
+                     "%u duplicates", p_sys->psz_import, i_queued, i_rejected,
+                     i_duplicates);
+        }
+    }
+
+end:
+    fclose(p_import->p_file);
+    free(p_import->psz_checkpoint);
+    free(p_import);
+    return NULL;
 }
 
 /*****************************************************************************
- * ItemChange: Playlist item change callback
+ * SpoolLock : try to take the lock of the spool, without waiting for it
  *****************************************************************************/
-static int ItemChange(vlc_object_t *p_this, const char *psz_var,
-                      vlc_value_t oldval, vlc_value_t newval, void *p_data)
+static bool SpoolLock(int i_fd)
 {
-    intf_thread_t  *p_intf  = p_data;
-    intf_sys_t     *p_sys   = p_intf->p_sys;
-    input_thread_t *p_input = newval.p_address;
+#ifndef _WIN32
+    return !flock(i_fd, LOCK_EX | LOCK_NB);
+#else
+    VLC_UNUSED(i_fd);
+    return false;
+#endif
+}
 
-    VLC_UNUSED(psz_var);
-    VLC_UNUSED(oldval);
+/*****************************************************************************
+ * SpoolCollect : delete the segments whose listens are all delivered
+ *****************************************************************************/
+static void SpoolCollect(intf_thread_t *p_intf, listenbrainz_spool_t *p_spool)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    int         i_done = 0;
 
-    p_sys->b_meta_read      = false;
+    vlc_mutex_lock(&p_sys->lock);
+    int64_t i_delivered = p_sys->pi_delivered[LISTEN_SPOOL];
+    vlc_mutex_unlock(&p_sys->lock);
 
-    if (p_sys->p_input != NULL)
+    while (i_done < p_spool->i_segments
+        && p_spool->p_segments[i_done].i_last <= i_delivered)
     {
-        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
-        vlc_object_release(p_sys->p_input);
-        p_sys->p_input = NULL;
-    }
+        char *psz_file;
 
-    if (p_input == NULL)
-        return VLC_SUCCESS;
+        if (asprintf(&psz_file, "%s" DIR_SEP "%s", p_sys->psz_spool,
+                     p_spool->p_segments[i_done].psz_name) != -1)
+        {
+            if (vlc_unlink(psz_file))
+                msg_Warn(p_intf, "cannot delete %s: %s", psz_file,
+                         vlc_strerror_c(errno));
+            free(psz_file);
+        }
+        i_done++;
+    }
+    p_spool->i_segments -= i_done;
+    memmove(p_spool->p_segments, p_spool->p_segments + i_done,
+            p_spool->i_segments * sizeof(*p_spool->p_segments));
+}
 
-    input_item_t *p_item = input_GetItem(p_input);
-    if (p_item == NULL)
-        return VLC_SUCCESS;
+/*****************************************************************************
+ * SpoolScan : find the oldest segments of the spool not read yet, at most
+ * i_max of them, in order
+ *****************************************************************************/
+static int SpoolScan(intf_thread_t *p_intf, listenbrainz_spool_t *p_spool,
+                     int i_max)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    const char  *psz_name;
+    const size_t i_suffix = sizeof(SPOOL_SUFFIX) - 1;
+    int         i_names = 0;
 
-    if (var_CountChoices(p_input, "video-es"))
+    DIR *p_dir = vlc_opendir(p_sys->psz_spool);
+    if (p_dir == NULL)
     {
-        msg_Dbg(p_this, "Not an audio-only input, not submitting");
-        return VLC_SUCCESS;
+        msg_Warn(p_intf, "cannot read %s: %s", p_sys->psz_spool,
+                 vlc_strerror_c(errno));
+        return 0;
     }
 
-    p_sys->time_total_pauses = 0;
-    time(&p_sys->p_current_song.date);        /* to be sent to ListenBrainz */
-    p_sys->p_current_song.i_start = mdate();    /* only used locally */
-
-    p_sys->p_input = vlc_object_hold(p_input);
-    var_AddCallback(p_input, "intf-event", PlayingChange, p_intf);
+    while ((psz_name = vlc_readdir(p_dir)) != NULL)
+    {
+        size_t  i_len = strlen(psz_name);
+        int     i;
 
-    if (input_item_IsPreparsed(p_item))
-        ReadMetaData(p_intf, p_input);
-    /* if the input item was not preparsed, we'll do it in PlayingChange()
-     * callback, when "state" == PLAYING_S */
+        if (i_len <= i_suffix || i_len >= SPOOL_NAME_MAX
+         || strcmp(psz_name + i_len - i_suffix, SPOOL_SUFFIX))
+            continue;
+        for (i = 0; i < p_spool->i_segments; i++)
+            if (!strcmp(psz_name, p_spool->p_segments[i].psz_name))
+                break;
+        if (i < p_spool->i_segments)
+            continue;
 
-    return VLC_SUCCESS;
+        /* insertion sort, the newest falling off the end */
+        if (i_names < i_max)
+            i = i_names++;
+        else if (strcmp(psz_name, p_spool->ppsz_scan[i_max - 1]) < 0)
+            i = i_max - 1;
+        else
+            continue;
+        for (; i > 0 && strcmp(psz_name, p_spool->ppsz_scan[i - 1]) < 0; i--)
+            memcpy(p_spool->ppsz_scan[i], p_spool->ppsz_scan[i - 1],
+                   SPOOL_NAME_MAX);
+        memcpy(p_spool->ppsz_scan[i], psz_name, i_len + 1);
+    }
+    closedir(p_dir);
+    return i_names;
 }
 
 /*****************************************************************************
- * Open: initialize and create stuff
+ * SpoolRead : queue the listens of a segment, waiting for room in the queue.
+ * Returns false when the spool is stopped.
  *****************************************************************************/
-static int Open(vlc_object_t *p_this)
+static bool SpoolRead(intf_thread_t *p_intf, listenbrainz_spool_t *p_spool,
+                      const char *psz_name)
 {
-    intf_thread_t   *p_intf     = (intf_thread_t*) p_this;
-    intf_sys_t      *p_sys      = calloc(1, sizeof(intf_sys_t));
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    char        *psz_file;
+    bool        b_truncated, b_stopped = false;
 
-    if (!p_sys)
-        return VLC_ENOMEM;
+    if (asprintf(&psz_file, "%s" DIR_SEP "%s", p_sys->psz_spool, psz_name) == -1)
+        return true;
+    p_spool->reader.p_file = vlc_fopen(psz_file, "rb");
+    if (p_spool->reader.p_file == NULL)
+    {
+        msg_Warn(p_intf, "cannot read %s: %s", psz_file, vlc_strerror_c(errno));
+        free(psz_file);
+        return true;
+    }
 
-    p_intf->p_sys = p_sys;
+    while (!b_stopped && ImportReadLine(&p_spool->reader, &b_truncated))
+    {
+        listenbrainz_song_t song = { 0 };
 
-    vlc_mutex_init(&p_sys->lock);
-    vlc_cond_init(&p_sys->wait);
+        if (b_truncated || p_spool->reader.psz_line[0] != '{'
+         || !ImportJson(p_spool->reader.psz_line, &song))
+        {
+            msg_Warn(p_intf, "invalid listen in %s", psz_file);
+            continue;
+        }
 
-    if (vlc_clone(&p_sys->thread, Run, p_intf, VLC_THREAD_PRIORITY_LOW))
-    {
-        vlc_cond_destroy(&p_sys->wait);
-        vlc_mutex_destroy(&p_sys->lock);
-        free(p_sys);
-        return VLC_ENOMEM;
+        /* the listens of all the instances meet here, and so do their
+         * duplicates */
+        uint64_t i_hash = HashListen(&song);
+        vlc_mutex_lock(&p_sys->lock);
+        bool b_new = DedupInsert(&p_sys->dedup, i_hash);
+        while (b_new && p_sys->i_songs >= QUEUE_MAX && !p_sys->b_spool_stop)
+            vlc_cond_wait(&p_sys->import_wait, &p_sys->lock);
+        b_stopped = p_sys->b_spool_stop;
+        if (b_new && (b_stopped
+         || QueueListen(p_sys, &song,
+                        &p_sys->p_queue[p_sys->i_songs]) != VLC_SUCCESS))
+            DedupRemove(&p_sys->dedup, i_hash);
+        else if (b_new)
+        {
+            listenbrainz_listen_t *p_listen = &p_sys->p_queue[p_sys->i_songs++];
+            p_listen->i_source = LISTEN_SPOOL;
+            p_listen->i_offset = ++p_spool->i_queued;
+            vlc_cond_broadcast(&p_sys->wait);
+        }
+        vlc_mutex_unlock(&p_sys->lock);
+        DeleteSong(&song);
     }
+    fclose(p_spool->reader.p_file);
+    free(psz_file);
 
-    var_AddCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
-
-    return VLC_SUCCESS;
+    /* deleted once its last listen queued, if any, is delivered */
+    int i = p_spool->i_segments++;
+    strcpy(p_spool->p_segments[i].psz_name, psz_name);
+    p_spool->p_segments[i].i_last = p_spool->i_queued;
+    return !b_stopped;
 }
 
 /*****************************************************************************
- * Close: destroy interface stuff
+ * Spool : wait for the lock of the spool, then submit its listens, those of
+ * this instance as those of the others. The segments are read as the queue
+ * has room for them, and deleted once delivered: those of an instance which
+ * stops before are read again by the next one to get the lock.
  *****************************************************************************/
-static void Close(vlc_object_t *p_this)
+static void *Spool(void *data)
 {
-    intf_thread_t               *p_intf = (intf_thread_t*) p_this;
-    intf_sys_t                  *p_sys  = p_intf->p_sys;
+    intf_thread_t           *p_intf = data;
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_spool_t    *p_spool = malloc(sizeof(*p_spool));
 
-    vlc_cancel(p_sys->thread);
-    vlc_join(p_sys->thread, NULL);
+    if (p_spool == NULL)
+        return NULL;
+    p_spool->i_queued = 0;
+    p_spool->i_segments = 0;
 
-    var_DelCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+    vlc_mutex_lock(&p_sys->config_lock);
+    bool b_leader = p_sys->b_leader;
+    vlc_mutex_unlock(&p_sys->config_lock);
 
-    if (p_sys->p_input != NULL)
+    vlc_mutex_lock(&p_sys->lock);
+    while (!p_sys->b_spool_stop)
     {
-        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
-        vlc_object_release(p_sys->p_input);
+        vlc_mutex_unlock(&p_sys->lock);
+
+        if (!b_leader && SpoolLock(p_sys->i_spool_fd))
+        {
+            msg_Info(p_intf, "Submitting the listens of the spool %s",
+                     p_sys->psz_spool);
+            vlc_mutex_lock(&p_sys->config_lock);
+            p_sys->b_leader = b_leader = true;
+            if (Reconfigure(p_intf) != VLC_SUCCESS)
+                msg_Err(p_intf, "cannot start the submission");
+            vlc_mutex_unlock(&p_sys->config_lock);
+        }
+
+        bool b_stopped = false;
+        if (b_leader)
+        {
+            SpoolCollect(p_intf, p_spool);
+            int i_names = SpoolScan(p_intf, p_spool,
+                                    SPOOL_SEGMENTS - p_spool->i_segments);
+            for (int i = 0; i < i_names && !b_stopped; i++)
+                b_stopped = !SpoolRead(p_intf, p_spool, p_spool->ppsz_scan[i]);
+        }
+
+        vlc_mutex_lock(&p_sys->lock);
+        /* woken up as listens are written or delivered */
+        if (!b_stopped && !p_sys->b_spool_stop)
+            vlc_cond_timedwait(&p_sys->import_wait, &p_sys->lock,
+                               mdate() + SPOOL_POLL);
     }
+    vlc_mutex_unlock(&p_sys->lock);
 
-    int i;
-    for (i = 0; i < p_sys->i_songs; i++)
-        DeleteSong(&p_sys->p_queue[i]);
-    vlc_UrlClean(&p_sys->p_submit_url);
-    vlc_cond_destroy(&p_sys->wait);
-    vlc_mutex_destroy(&p_sys->lock);
-    free(p_sys);
+    free(p_spool);
+    return NULL;
 }
 
-static void HandleInterval(mtime_t *next, unsigned int *i_interval)
+/*****************************************************************************
+ * HelperForge : frame i_batch queued listens from i_first for the helper,
+ * ending the batch, and store in *pi_framed how many were. A listen too large
+ * for a frame, or whose metadata cannot be decoded, is dropped.
+ * p_sys->lock held.
+ *****************************************************************************/
+static int HelperForge(intf_thread_t *p_intf, uint64_t i_first, int i_batch,
+                       struct vlc_memstream *p_frames, int *pi_framed)
 {
-    if (*i_interval == 0)
+    intf_sys_t  *p_sys = p_intf->p_sys;
+
+    vlc_memstream_open(p_frames);
+    *pi_framed = 0;
+
+    for (int i = 0; i < i_batch; i++)
     {
-        /* first interval is 1 minute */
-        *i_interval = 1;
+        const listenbrainz_listen_t *p_listen =
+            &p_sys->p_queue[i_first - p_sys->i_queue_base + i];
+        const listenbrainz_string_t *pp_strings[] = {
+            p_listen->p_a, p_listen->p_t, p_listen->p_b, p_listen->p_m };
+        char        *ppsz_meta[ARRAY_SIZE(pp_strings)] = { NULL };
+        uint8_t     p_head[4 + 8 + 1];
+        uint32_t    i_size = 8 + 1;
+
+        for (size_t j = 0; j < ARRAY_SIZE(pp_strings); j++)
+            if (pp_strings[j] != NULL)
+            {
+                ppsz_meta[j] = vlc_uri_decode_duplicate(pp_strings[j]->psz);
+                i_size += 2 + (ppsz_meta[j] ? strlen(ppsz_meta[j])
+                                            : HELPER_FRAME_MAX);
+            }
+
+        if (i_size <= HELPER_FRAME_MAX)
+        {
+            SetDWBE(p_head, i_size);
+            SetQWBE(p_head + 4, p_listen->date);
+            p_head[12] = (p_listen->p_b ? HELPER_ALBUM : 0)
+                       | (p_listen->p_m ? HELPER_MBID : 0);
+            vlc_memstream_write(p_frames, p_head, sizeof(p_head));
+
+            for (size_t j = 0; j < ARRAY_SIZE(pp_strings); j++)
+                if (ppsz_meta[j] != NULL)
+                {
+                    uint8_t p_len[2];
+                    size_t  i_len = strlen(ppsz_meta[j]);
+
+                    SetWBE(p_len, i_len);
+                    vlc_memstream_write(p_frames, p_len, sizeof(p_len));
+                    vlc_memstream_write(p_frames, ppsz_meta[j], i_len);
+                }
+            (*pi_framed)++;
+        }
+        else
+        {
+            msg_Warn(p_intf, "Dropping the listen %s - %s: it cannot be "
+                     "handed to the helper", p_listen->p_a->psz_json,
+                     p_listen->p_t->psz_json);
+            p_sys->pi_metrics[METRIC_DROPS]++;
+        }
+        for (size_t j = 0; j < ARRAY_SIZE(pp_strings); j++)
+            free(ppsz_meta[j]);
     }
-    else
+    if (*pi_framed > 0)
     {
-        /* else we double the previous interval, up to 120 minutes */
-        *i_interval <<= 1;
-        if (*i_interval > 120)
-            *i_interval = 120;
+        static const uint8_t p_end[4] = { 0 };
+        vlc_memstream_write(p_frames, p_end, sizeof(p_end));
     }
-    *next = mdate() + (*i_interval * 1000000 * 60);
+    return vlc_memstream_close(p_frames);
 }
 
 /*****************************************************************************
- * Run : submit songs
+ * HelperAck : wait for the helper to acknowledge a batch until the deadline.
+ * Returns the number of listens it took, -1 on error.
  *****************************************************************************/
-static void *Run(void *data)
+static int64_t HelperAck(listenbrainz_endpoint_t *p_ep, mtime_t deadline)
+{
+    struct pollfd   ufd = { .fd = vlc_tls_GetFD(p_ep->p_sock), .events = POLLIN };
+    uint8_t         p_ack[4];
+    size_t          i_len = 0;
+
+    while (i_len < sizeof(p_ack))
+    {
+        mtime_t i_left = deadline - ClockNow();
+        if (i_left <= 0 || vlc_poll_i11e(&ufd, 1, i_left / 1000) <= 0)
+            return -1;
+        ssize_t i_read = vlc_tls_Read(p_ep->p_sock, p_ack + i_len,
+                                      sizeof(p_ack) - i_len, false);
+        if (i_read <= 0)
+            return -1;
+        i_len += i_read;
+    }
+    return GetDWBE(p_ack);
+}
+
+/*****************************************************************************
+ * Handoff : the thread of the helper endpoint. It hands the listens to the
+ * helper as they are queued, which submits them: nothing waits on the
+ * network here.
+ *****************************************************************************/
+static void *Handoff(void *data)
 {
-    intf_thread_t          *p_intf = data;
-    uint8_t                 p_buffer[1024];
+    listenbrainz_endpoint_t *p_ep = data;
+    intf_thread_t           *p_intf = p_ep->p_intf;
+    intf_sys_t              *p_sys = p_intf->p_sys;
     int                     canc = vlc_savecancel();
-    char                    *psz_url, *psz_submission_url;
-    int                     i_ret;
-    time_t                  timestamp;
 
-    /* data about ListenBrainz session */
-    mtime_t                 next_exchange = 0; /**< when can we send data  */
-    unsigned int            i_interval = 0;     /**< waiting interval (secs)*/
+    vlc_interrupt_set(p_ep->p_interrupt);
 
-    intf_sys_t *p_sys = p_intf->p_sys;
-    // TODO: Add wait
-    
-    /* main loop */
     for (;;)
     {
-        vlc_restorecancel(canc);
-        mwait(next_exchange);
+        PublishMetrics(p_intf);
 
+        vlc_restorecancel(canc);
+        ClockWait(p_ep->next_exchange);
         vlc_mutex_lock(&p_sys->lock);
-        mutex_cleanup_push(&p_sys->lock);
-
-        while (p_sys->i_songs == 0)
-            vlc_cond_wait(&p_sys->wait, &p_sys->lock);
+        WaitListens(p_ep, 0);
+        canc = vlc_savecancel();
 
-        vlc_cleanup_pop();
+        struct vlc_memstream frames;
+        uint64_t i_first = p_ep->i_next;
+        int i_batch = p_sys->i_queue_base + p_sys->i_songs - i_first;
+        int i_framed;
+        int i_ret = HelperForge(p_intf, i_first, i_batch, &frames, &i_framed);
         vlc_mutex_unlock(&p_sys->lock);
-        canc = vlc_savecancel();
 
-        p_sys->psz_user_token = var_InheritString(p_intf, "listenbrainz-usertoken");
-        msg_Dbg(p_intf, "Begin...");
+        if (i_ret)
+            goto out;
 
-        /* usertoken have not been setup */
-        if (EMPTY_STR(p_sys->psz_user_token))
+        if (frames.length > 0 && p_ep->p_sock == NULL)
+            p_ep->p_sock = ConnectLocal(p_intf, p_ep->psz_socket);
+        if (frames.length > 0 && (p_ep->p_sock == NULL
+         || vlc_tls_Write(p_ep->p_sock, frames.ptr, frames.length)
+                != (ssize_t) frames.length
+         || HelperAck(p_ep, ClockNow() + HELPER_TIMEOUT) != i_framed))
         {
-            free(p_sys->psz_user_token);
-            /* usertoken not set */
-            vlc_dialog_display_error(p_intf,
-                                     "Listenbrainz usertoken not set",
-                                     "%s", "Please set a user token or disable the "
-                                             "ListenBrainz plugin, and restart VLC.\n"
-                                             "Visit https://listenbrainz.org/profile/ to get a user token.");
-            goto out;
+            /* the listens wait in the queue until the helper is back, and
+             * are handed again from the first: it drops those it spooled */
+            if (p_ep->i_failures++ == 0)
+                msg_Warn(p_intf, "cannot hand listens to the helper at %s",
+                         p_ep->psz_socket);
+            CountMetric(p_sys, METRIC_FAILURES_NETWORK);
+            if (p_ep->p_sock != NULL)
+            {
+                vlc_tls_Close(p_ep->p_sock);
+                p_ep->p_sock = NULL;
+            }
+            p_ep->next_exchange = ClockNow() + HELPER_RETRY;
+            free(frames.ptr);
+            continue;
         }
+        free(frames.ptr);
 
-        time(&timestamp);
+        /* the dropped listens leave the queue with the spooled ones */
+        vlc_mutex_lock(&p_sys->lock);
+        p_ep->i_next = __MAX(p_ep->i_next, i_first + i_batch);
+        TrimQueue(p_sys);
+        p_sys->pi_metrics[METRIC_SUBMITS]++;
+        p_sys->pi_metrics[METRIC_LISTENS] += i_framed;
+        vlc_mutex_unlock(&p_sys->lock);
 
-        psz_submission_url = var_InheritString(p_intf, "submission-url");
-        if (!psz_submission_url)
-            goto out;
+        if (p_ep->i_failures > 0)
+            msg_Info(p_intf, "the helper at %s is reachable again",
+                     p_ep->psz_socket);
+        p_ep->i_failures = 0;
+        p_ep->next_exchange = VLC_TICK_INVALID;
+        msg_Dbg(p_intf, "%d listens handed to the helper", i_framed);
+    }
+    out:
+    vlc_restorecancel(canc);
+    return NULL;
+}
 
-        i_ret = asprintf(&psz_url, "https://%s/1/submit-listens", psz_submission_url);
+#ifndef _WIN32
+/*****************************************************************************
+ * ServeQueue : queue a listen received on a socket, waiting for room in the
+ * queue, and release it. Returns false when the sockets are closing.
+ *****************************************************************************/
+static bool ServeQueue(intf_thread_t *p_intf, listenbrainz_song_t *p_song)
+{
+    intf_sys_t  *p_sys = p_intf->p_sys;
+    bool        b_stopped;
 
-        free(psz_submission_url);
-        if (i_ret == -1)
-            goto out;
+    vlc_mutex_lock(&p_sys->lock);
+    while (p_sys->psz_spool == NULL && p_sys->i_songs >= QUEUE_MAX
+        && !p_sys->b_serve_stop)
+        vlc_cond_wait(&p_sys->import_wait, &p_sys->lock);
+    b_stopped = p_sys->b_serve_stop;
+    if (!b_stopped)
+        EnqueueSong(p_intf, p_song);
+    vlc_mutex_unlock(&p_sys->lock);
+    DeleteSong(p_song);
+    return !b_stopped;
+}
 
-        /* parse the submission url */
-        vlc_UrlParse(&p_sys->p_submit_url, psz_url);
-        free(psz_url);
+/*****************************************************************************
+ * ServeListen : queue a listen framed by an instance handing it over, waiting
+ * for room in the queue. Returns false when the helper is stopped.
+ *****************************************************************************/
+static bool ServeListen(intf_thread_t *p_intf, const uint8_t *p_frame,
+                        uint32_t i_size)
+{
+    char                *ppsz_meta[4] = { NULL };
+    listenbrainz_song_t song = { 0 };
+    const uint8_t       *p = p_frame + 8 + 1, *p_end = p_frame + i_size;
+    bool                b_valid = true;
 
-        msg_Dbg(p_intf, "Going to submit some data...");
-        vlc_url_t *url;
-        struct vlc_memstream req, payload;
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_meta) && b_valid; i++)
+    {
+        /* the artist and the title, then what the flags tell */
+        if (i >= 2 && !(p_frame[8] & (i == 2 ? HELPER_ALBUM : HELPER_MBID)))
+            continue;
+        if (p_end - p < 2 || p_end - p - 2 < GetWBE(p))
+            b_valid = false;
+        else
+        {
+            ppsz_meta[i] = strndup((const char *) p + 2, GetWBE(p));
+            b_valid = ppsz_meta[i] != NULL;
+            p += 2 + GetWBE(p);
+        }
+    }
+    if (b_valid)
+        b_valid = ImportSong(&song, ppsz_meta[0], ppsz_meta[1], ppsz_meta[2],
+                             ppsz_meta[3], GetQWBE(p_frame));
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_meta); i++)
+        free(ppsz_meta[i]);
+    if (!b_valid)
+    {
+        msg_Warn(p_intf, "invalid listen handed over");
+        return true;
+    }
+    return ServeQueue(p_intf, &song);
+}
 
-        vlc_memstream_open(&payload);
+/*****************************************************************************
+ * IngestRead : queue the listens received from a player, JSON objects in the
+ * format of the ListenBrainz exports, one per line. Invalid lines are
+ * skipped. Returns false to drop the player, after a line too long.
+ *****************************************************************************/
+static bool IngestRead(intf_thread_t *p_intf, listenbrainz_client_t *p_client)
+{
+    size_t  i_pos = 0;
+    bool    b_running = true;
+    uint8_t *p_end;
 
-        /* forge the HTTP POST request */
-        vlc_mutex_lock(&p_sys->lock);
+    while (b_running && (p_end = memchr(p_client->p_buf + i_pos, '\n',
+                                        p_client->i_len - i_pos)) != NULL)
+    {
+        char                *psz_line = (char *) p_client->p_buf + i_pos;
+        listenbrainz_song_t song = { 0 };
 
-        url = &p_sys->p_submit_url;
-        i_interval = 0;
-        next_exchange = VLC_TICK_INVALID;
+        i_pos = p_end + 1 - p_client->p_buf;
+        *p_end = '\0';
+        if (p_end > p_client->p_buf && p_end[-1] == '\r')
+            p_end[-1] = '\0';
+        if (!*psz_line)
+            continue;
 
-        if(p_sys->i_songs == 1)
-            vlc_memstream_printf(&payload, "{\"listen_type\":\"single\",\"payload\":[");
+        if (ImportJson(psz_line, &song))
+            b_running = ServeQueue(p_intf, &song);
         else
-            vlc_memstream_printf(&payload, "{\"listen_type\":\"import\",\"payload\":[");
+            msg_Warn(p_intf, "invalid listen ingested, skipped");
+    }
+    if (i_pos == 0 && p_client->i_len == sizeof(p_client->p_buf))
+    {
+        msg_Warn(p_intf, "listen ingested too long, closing the connection");
+        return false;
+    }
+    p_client->i_len -= i_pos;
+    memmove(p_client->p_buf, p_client->p_buf + i_pos, p_client->i_len);
+    return b_running;
+}
 
-        for (int i_song = 0 ; i_song < p_sys->i_songs ; i_song++)
-        {
-            listenbrainz_song_t *p_song = &p_sys->p_queue[i_song];
+/*****************************************************************************
+ * ServeAck : acknowledge the frames of a batch, all queued or spooled.
+ * Returns false to drop the client, which then hands them again.
+ *****************************************************************************/
+static bool ServeAck(listenbrainz_client_t *p_client)
+{
+    uint8_t p_ack[4];
 
-            vlc_memstream_printf(&payload, "{\"listened_at\": %"PRIu64, (uint64_t)p_song->date);
-            vlc_memstream_printf(&payload, ", \"track_metadata\": {\"artist_name\": \"%s\"", vlc_uri_decode(p_song->psz_a));
-            vlc_memstream_printf(&payload, ", \"track_name\": \"%s\"", vlc_uri_decode(p_song->psz_t));
-            if (p_song->psz_b != NULL)
-                vlc_memstream_printf(&payload, ", \"release_name\": \"%s\"", vlc_uri_decode(p_song->psz_b));
-            if (p_song->psz_m != NULL)
-                vlc_memstream_printf(&payload, ", \"additional_info\": {\"recording_mbid\":\"%s\"} ", vlc_uri_decode(p_song->psz_m));
-            vlc_memstream_printf(&payload, "}}");
-        }
+    SetDWBE(p_ack, p_client->i_frames);
+    p_client->i_frames = 0;
+    return write(p_client->i_fd, p_ack, sizeof(p_ack)) == sizeof(p_ack);
+}
 
-        vlc_memstream_printf(&payload, "]}");
-        vlc_mutex_unlock(&p_sys->lock);
+/*****************************************************************************
+ * ServeRead : queue the frames received from a client, acknowledging its
+ * batches. Returns false to drop it, after a malformed frame.
+ *****************************************************************************/
+static bool ServeRead(intf_thread_t *p_intf, listenbrainz_client_t *p_client)
+{
+    size_t  i_pos = 0;
+    bool    b_valid = true;
 
-        if (vlc_memstream_close(&payload))
-            goto out;
+    while (b_valid && p_client->i_len - i_pos >= 4)
+    {
+        uint32_t i_size = GetDWBE(p_client->p_buf + i_pos);
 
-        vlc_memstream_open(&req);
-        vlc_memstream_printf(&req, "POST %s HTTP/1.1\r\n", url->psz_path);
-        vlc_memstream_printf(&req, "Host: %s\r\n", url->psz_host);
-        vlc_memstream_printf(&req, "Authorization: Token %s\r\n", p_sys->psz_user_token);
-        vlc_memstream_puts(&req, "User-Agent:"
-                                 ""PACKAGE_NAME"/"PACKAGE_VERSION"\r\n");
-        vlc_memstream_puts(&req, "Connection: close\r\n");
-        vlc_memstream_puts(&req, "Accept-Encoding: identity\r\n");
-        vlc_memstream_printf(&req, "Content-Length: %zu\r\n", payload.length);
-        vlc_memstream_puts(&req, "Content-Type: application/json\r\n");
-        vlc_memstream_puts(&req, "\r\n");
-        /* Could avoid copying payload with iovec... but efforts */
-        vlc_memstream_write(&req, payload.ptr, payload.length);
-        vlc_memstream_puts(&req, "\r\n\r\n");
-        free(payload.ptr);
+        if (i_size == 0)
+        {
+            b_valid = ServeAck(p_client);
+            i_pos += 4;
+        }
+        else if (i_size < 8 + 1 || i_size > HELPER_FRAME_MAX)
+            b_valid = false;
+        else if (p_client->i_len - i_pos - 4 < i_size)
+            break;
+        else
+        {
+            b_valid = ServeListen(p_intf, p_client->p_buf + i_pos + 4, i_size);
+            p_client->i_frames++;
+            i_pos += 4 + i_size;
+        }
+    }
+    p_client->i_len -= i_pos;
+    memmove(p_client->p_buf, p_client->p_buf + i_pos, p_client->i_len);
+    return b_valid;
+}
 
-        if (vlc_memstream_close(&req)) /* Out of memory */
-            goto out;
+/*****************************************************************************
+ * Serve : accept the listens other instances hand to this one, the helper,
+ * and those other players send, and queue them with those played here. While
+ * the queue is full, they are not read and wait on the side of the senders.
+ *****************************************************************************/
+static void *Serve(void *data)
+{
+    intf_thread_t           *p_intf = data;
+    intf_sys_t              *p_sys = p_intf->p_sys;
+    listenbrainz_client_t   *p_clients;
+    struct pollfd           ufd[2 + SERVE_CLIENTS];
+    int                     i_clients = 0;
 
-        msg_Dbg(p_intf, "%s", req.ptr);
+    p_clients = malloc(SERVE_CLIENTS * sizeof(*p_clients));
+    if (p_clients == NULL)
+        return NULL;
+    vlc_interrupt_set(p_sys->p_serve_interrupt);
 
-        msg_Dbg(p_intf, "Open socket");
-        vlc_tls_creds_t *creds = vlc_tls_ClientCreate(VLC_OBJECT(p_intf));
-        char *alp;
-        vlc_tls_t *sock = vlc_tls_SocketOpenTLS(creds, url->psz_host, 443, NULL, NULL, NULL);
-        msg_Dbg(p_intf, "Close socket");
+    for (;;)
+    {
+        vlc_mutex_lock(&p_sys->lock);
+        bool b_stopped = p_sys->b_serve_stop;
+        vlc_mutex_unlock(&p_sys->lock);
+        if (b_stopped)
+            break;
 
-        if (sock == NULL)
+        /* a socket not open is -1, which poll() ignores */
+        ufd[0].fd = p_sys->i_serve_fd;
+        ufd[1].fd = p_sys->i_ingest_fd;
+        for (int i = 0; i < i_clients; i++)
+            ufd[2 + i].fd = p_clients[i].i_fd;
+        for (int i = 0; i < 2 + i_clients; i++)
+            ufd[i].events = POLLIN;
+        if (vlc_poll_i11e(ufd, 2 + i_clients, -1) < 0)
         {
-            /* If connection fails, we assume we must handshake again */
-            HandleInterval(&next_exchange, &i_interval);
-            free(req.ptr);
+            /* interrupted to stop, else back off from an error which would
+             * come again at once */
+            if (errno != EINTR)
+            {
+                msg_Err(p_intf, "cannot poll the sockets: %s",
+                        vlc_strerror_c(errno));
+                vlc_poll_i11e(NULL, 0, SERVE_RETRY / 1000);
+            }
             continue;
         }
 
-        /* we transmit the data */
-        msg_Warn(p_intf, "Begin transmission");
-        int i_net_ret = vlc_tls_Write(sock, req.ptr, req.length);
-        msg_Warn(p_intf, "Transmission End");
-        free(req.ptr);
-        if (i_net_ret == -1)
+        for (int i = i_clients - 1; i >= 0; i--)
         {
-            /* If connection fails, we assume we must handshake again */
-            HandleInterval(&next_exchange, &i_interval);
-            vlc_tls_Close(sock);
-            continue;
+            listenbrainz_client_t *p_client = &p_clients[i];
+
+            if (!ufd[2 + i].revents)
+                continue;
+            ssize_t i_read = read(p_client->i_fd,
+                                  p_client->p_buf + p_client->i_len,
+                                  sizeof(p_client->p_buf) - p_client->i_len);
+            if (i_read > 0)
+            {
+                p_client->i_len += i_read;
+                if (p_client->b_json ? IngestRead(p_intf, p_client)
+                                     : ServeRead(p_intf, p_client))
+                    continue;
+            }
+            net_Close(p_client->i_fd);
+            memmove(p_client, p_client + 1,
+                    (--i_clients - i) * sizeof(*p_client));
         }
 
-        /* FIXME: this might wait forever */
-        /* FIXME: With TCP, you should never assume that a single read will
-         * return the entire response... */
-        msg_Warn(p_intf, "Checking response");
-        i_net_ret = vlc_tls_Read(sock, p_buffer, sizeof(p_buffer) - 1, false);
-        msg_Warn(p_intf, "Response: %s", (char *) p_buffer);
-        vlc_tls_Close(sock);
-        if (i_net_ret <= 0)
+        for (int i = 0; i < 2; i++)
         {
-            msg_Warn(p_intf, "No response");
-            /* if we get no answer, something went wrong : try again */
-            continue;
-        }
-        p_buffer[i_net_ret] = '\0';
-        if (strstr((char *) p_buffer, "OK")) {
-            for (int i = 0; i < p_sys->i_songs; i++)
-                DeleteSong(&p_sys->p_queue[i]);
-            p_sys->i_songs = 0;
-
-            i_interval = 0;
-            next_exchange = VLC_TICK_INVALID;
-            msg_Dbg(p_intf, "Submission successful!");
-        } else {
-            msg_Warn(p_intf, "Error: %s", strstr((char *) p_buffer, "FAILED"));
-            HandleInterval(&next_exchange, &i_interval);
-            continue;
+            if (!ufd[i].revents)
+                continue;
+            int i_fd = vlc_accept(ufd[i].fd, NULL, NULL, false);
+            if (i_fd != -1 && i_clients == SERVE_CLIENTS)
+            {
+                msg_Warn(p_intf, "too many connections, closing a new one");
+                net_Close(i_fd);
+            }
+            else if (i_fd != -1)
+            {
+                p_clients[i_clients].i_fd = i_fd;
+                p_clients[i_clients].b_json = i == 1;
+                p_clients[i_clients].i_frames = 0;
+                p_clients[i_clients++].i_len = 0;
+            }
         }
     }
-    out:
-        vlc_restorecancel(canc);
-        return NULL;
 
+    for (int i = 0; i < i_clients; i++)
+        net_Close(p_clients[i].i_fd);
+    free(p_clients);
+    return NULL;
 }
+#else
+/* the sockets are not supported on this system, see ServeSocket */
+static void *Serve(void *data)
+{
+    VLC_UNUSED(data);
+    return NULL;
+}
+#endif